@@ -7,265 +7,4637 @@
 ** (based on the example in README.md from https://github.com/bigr/o5mreader)
 **
 */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* mremap */
+#endif
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+#ifndef O5M2SQLITE_OMIT_GZIP
+#include <signal.h>
+#include <unistd.h>
+#include <zlib.h>
+#endif
 
 #include "o5mreader.c"
 #include "sqlite3.h"
+#define SQLITE_CORE 1
+#include "waynodes.c"
 
 #define O5M2SQLITE_VERSION "0.3 alpha"
 
-#define O5M2SQLITE_CREATE_TABLES \
-"CREATE TABLE nodes (node_id INTEGER PRIMARY KEY,lat REAL,lon REAL);\n" \
-"CREATE TABLE node_tags (node_id INTEGER,key TEXT,value TEXT);\n" \
-"CREATE TABLE way_tags (way_id INTEGER,key TEXT,value TEXT);\n" \
-"CREATE TABLE way_nodes (way_id INTEGER,local_order INTEGER,node_id INTEGER);\n" \
-"CREATE TABLE relation_tags (relation_id INTEGER,key TEXT,value TEXT);\n" \
-"CREATE TABLE relation_members (relation_id INTEGER,type TEXT,ref INTEGER,role TEXT,local_order INTEGER);\n"
-
-#define O5M2SQLITE_CREATE_INDEXES \
-"CREATE INDEX node_tags__node_id ON node_tags ( node_id );\n" \
-"CREATE INDEX node_tags__key ON node_tags ( key );\n" \
-"CREATE INDEX way_tags__way_id ON way_tags ( way_id );\n" \
-"CREATE INDEX way_tags__key ON way_tags ( key );\n" \
-"CREATE INDEX way_nodes__way_id ON way_nodes ( way_id );\n" \
-"CREATE INDEX way_nodes__node_id ON way_nodes ( node_id );\n" \
-"CREATE INDEX relation_tags__relation_id ON relation_tags ( relation_id );\n" \
-"CREATE INDEX relation_tags__key ON relation_tags ( key );\n" \
-"CREATE INDEX relation_members__relation_id ON relation_members ( relation_id );\n" \
-"CREATE INDEX relation_members__type ON relation_members ( type, ref );\n\n" \
-"-- Spatial R*Tree index on all ways with key='highway'\n" \
-"CREATE VIRTUAL TABLE rtree_way_highway USING rtree( way_id,min_lat, max_lat,min_lon, max_lon );\n" \
-"INSERT INTO rtree_way_highway (way_id,min_lat,       max_lat,       min_lon,       max_lon)\n" \
-"SELECT                way_tags.way_id,min(nodes.lat),max(nodes.lat),min(nodes.lon),max(nodes.lon)\n" \
+/*
+** The tables and indexes are assembled at startup from the layout options
+** (--schema, --dict), see schema_build().
+*/
+/* format: table, entity type */
+#define O5M2SQLITE_RTREE_TABLE \
+"CREATE VIRTUAL TABLE %s USING rtree( %s_id,min_lat, max_lat,min_lon, max_lon );\n"
+
+/*
+** Way index with --locations=none, format: condition, table, "way", table,
+** the scale of each of the four aggregates, the nodes table, condition
+*/
+#define O5M2SQLITE_CREATE_RTREE \
+"-- Spatial R*Tree index on all ways with %s\n" \
+O5M2SQLITE_RTREE_TABLE \
+"INSERT INTO %s (way_id,min_lat,       max_lat,       min_lon,       max_lon)\n" \
+"SELECT                way_tags.way_id,min(nodes.lat)%s,max(nodes.lat)%s,min(nodes.lon)%s,max(nodes.lon)%s\n" \
 "FROM      way_tags\n" \
 "LEFT JOIN way_nodes ON way_tags.way_id=way_nodes.way_id\n" \
-"LEFT JOIN nodes     ON way_nodes.node_id=nodes.node_id\n" \
-"WHERE way_tags.key='highway'\n" \
+"LEFT JOIN %s ON way_nodes.node_id=nodes.node_id\n" \
+"WHERE %s\n" \
 "GROUP BY way_tags.way_id;\n"
 
-#define ins_node       "INSERT INTO nodes (node_id,lat,lon) VALUES (?1,?2,?3);"
-#define ins_node_tag   "INSERT INTO node_tags (node_id,key,value) VALUES (?1,?2,?3);"
-#define ins_way_tag    "INSERT INTO way_tags (way_id,key,value) VALUES (?1,?2,?3);"
-#define ins_way_node   "INSERT INTO way_nodes (way_id,local_order,node_id) VALUES (?1,?2,?3);"
-#define ins_rel_tag    "INSERT INTO relation_tags (relation_id,key,value) VALUES (?1,?2,?3);"
-#define ins_rel_member "INSERT INTO relation_members (relation_id,type,ref,role) VALUES (?1,?2,?3,?4);"
+#define O5M2SQLITE_HELP \
+"o5m2sqlite (Version " O5M2SQLITE_VERSION ")\n\n" \
+"Converts OpenStreetMap data in binary o5m format into a SQLite database.\n" \
+"(SQLite Version " SQLITE_VERSION ")\n\n" \
+"Usage:\n" \
+"o5m2sqlite [options] in.o5m out.sqlite3\tconvert in.o5m to out.sqlite3\n" \
+"o5m2sqlite [--schema=S] --schema\tshow the resulting sqlite database schema\n" \
+"o5m2sqlite [filters] --dry-run in.o5m\ttest filters on in.o5m\n" \
+"o5m2sqlite [options] --update in.o5c db.sqlite3\tapply the change file in.o5c\n" \
+"in.o5m and in.o5c may be gzip compressed, - reads them from stdin\n\n" \
+"Options:\n" \
+"--schema=S\tdefault: rowid tables with separate id indexes\n" \
+"\t\tclustered: child tables WITHOUT ROWID keyed on their parent id\n" \
+"--dict\t\tstore tag keys, values and member roles as ids into dictionary\n" \
+"\t\ttables, with views under the usual table names\n" \
+"--coords=C\treal: lat/lon in degrees (default)\n" \
+"\t\tfixed: lat/lon as integers in 1E-7 degrees in nodes_fixed, with a\n" \
+"\t\tview nodes in degrees\n" \
+"--ways=W\trows: one way_nodes row per node of a way (default)\n" \
+"\t\tpacked: one ways row per way, the node ids as delta coded varint\n" \
+"\t\tBLOB, with a view way_nodes over way_nodes_unpack(nodes).\n" \
+"\t\tNOTE: other SQLite clients can only query way_nodes with the\n" \
+"\t\twaynodes extension loaded: make waynodes.so, then .load ./waynodes\n" \
+"\t\tin the sqlite3 shell or sqlite3_load_extension() in programs\n" \
+"--node-ways\twith --ways=packed: build the node_ways table for node to\n" \
+"\t\tway lookups at the end\n" \
+"--geometry=G\tnone (default), wkb or spatialite: write the LineString or\n" \
+"\t\tPolygon of every way into way_geometry while importing\n" \
+"--rtree=LIST\tR*Tree indexes to build, comma separated [node:|way:|relation:]key\n" \
+"\t\tor key=value, without type for all three, key * for all\n" \
+"\t\tentities of the type (default way:highway, empty for none)\n" \
+"--types=LIST\timport only these of node,way,relation\n" \
+"--keep=LIST\timport only entities with one of these tags, comma separated\n" \
+"\t\t[node:|way:|relation:]key or key=value; types without an entry\n" \
+"\t\tare not filtered\n" \
+"--bbox=W,S,E,N\timport only nodes in the box, ways with a node in it and\n" \
+"\t\trelations with such a node or way member\n" \
+"--polygon=F\tlike --bbox for the area of the osmosis .poly file F\n" \
+"--nodes=N\tall: import all nodes that pass the filters (default)\n" \
+"\t\treferenced: mark the nodes of the imported ways and relations in\n" \
+"\t\ta first pass, then import only these and tagged nodes\n" \
+"--dry-run\tdecode and filter in.o5m only, print the counts and the speed\n" \
+"--bench\t\tprint the times of the import stages as one line of JSON to stdout\n" \
+"--progress=S\tprint the counts, rates and ETA every S seconds (default 10, 0 = off)\n" \
+"--stats=FILE\twrite the counts, stage times and cache counters as JSON to FILE\n" \
+"\t\tat the end (- = stdout)\n" \
+"--update\tapply an o5c change file to a database imported with the same\n" \
+"\t\tlayout and --rtree options, in one transaction\n" \
+"--locations=L\tnode location store for the bounding boxes of the R*Trees,\n" \
+"\t\tfilled while decoding: auto (default), sparse, dense, or none to\n" \
+"\t\tjoin the way indexes from the tables at the end instead\n" \
+"--threads=N\tdecode with N threads, in.o5m is split at reset (0xff) points\n" \
+"--pipeline\tdecode on a separate thread, in parallel to the database writer\n" \
+"--queue-depth=N\tbatches in flight per decode thread (default 4)\n" \
+"--batch-size=N\trows per batch (default 4096)\n" \
+"--insert-rows=N\trows per INSERT statement (default 32, 1 = single-row inserts)\n" \
+"--insert-stats\tprint rows/s per table at the end\n" \
+"--shards\twrite nodes, ways and relations into separate databases on\n" \
+"\t\tseparate threads, index them in parallel and combine them at the end\n" \
+"--sort-memory=MB\tsort the rows of every table by its main index key with\n" \
+"\t\tan external merge sort in MB of memory and load them in that order\n" \
+"--memory=MB\tsplit MB over the page cache, index sorts, mmap, input buffers\n" \
+"\t\tand batch queues, with bulk load pragmas (no rollback journal)\n" \
+"--checkpoint=N\tcommit every N entities and record where to continue\n" \
+"--resume\tcontinue an import with --checkpoint from its last checkpoint\n\n" \
+"(compile time: " __DATE__ " " __TIME__ "  gcc " __VERSION__ ")\n"
+
+/* default rows per decoded batch before it is handed to the writer */
+#define O5M2SQLITE_BATCH_ROWS 4096
+/* default rows per multi-row INSERT statement */
+#define O5M2SQLITE_INSERT_ROWS 32
+/* default entities between the commits of --resume without --checkpoint */
+#define O5M2SQLITE_CHECKPOINT 10000000
+/* default batches in flight per decode thread */
+#define O5M2SQLITE_QUEUE_DEPTH 4
+/* rough memory of a batch per row: the row, its strings and spare array capacity */
+#define O5M2SQLITE_BATCH_ROW_BYTES 64
+/* page size of new databases with --memory */
+#ifndef O5M2SQLITE_PAGE_SIZE
+#define O5M2SQLITE_PAGE_SIZE 4096
+#endif
+/* largest working memory of one sort in SQLite (SQLITE_MAX_PMASZ) */
+#define O5M2SQLITE_MAX_SORT_MEMORY (512*1024*1024)
+/* minimum size of a chunk handed to one decode thread */
+#ifndef O5M2SQLITE_MIN_CHUNK
+#define O5M2SQLITE_MIN_CHUNK (8*1024*1024)
+#endif
+
+/* sqlite db handler */
+sqlite3 *db;
+
+/* import options */
+size_t batch_rows = O5M2SQLITE_BATCH_ROWS;
+int queue_depth = O5M2SQLITE_QUEUE_DEPTH;
+int insert_rows = O5M2SQLITE_INSERT_ROWS;
+int insert_stats = 0;
+size_t sort_memory = 0;     /* bytes, 0 = insert rows in file order */
+int updating = 0;           /* --update: apply a change file to an existing database */
+int bench = 0;              /* --bench: print the stage times as one line of JSON */
+char *bench_args;           /* the command line for --bench, JSON escaped */
+int sharded = 0;            /* --shards */
+uint64_t checkpoint_interval = 0;   /* --checkpoint: entities per transaction, 0 = one transaction */
+int resuming = 0;           /* --resume: continue an import from its last checkpoint */
+int queue_depth_set = 0;    /* --queue-depth given, --memory keeps it */
+
+/*
+** --memory: one budget split by plan_memory() over the page cache of every
+** connection, the working memory of CREATE INDEX (SQLite sorts in as much
+** memory as cache_size allows, up to 512 MB, before it spills into temp
+** files), memory mapped reads of the database, the input buffers and the
+** batch queues. --sort-memory is taken out of it as given. The node
+** location store is a memory map of its own and not part of the budget.
+*/
+typedef struct {
+    uint64_t total;         /* bytes, 0 = SQLite's defaults */
+    uint64_t cache;         /* page cache of each connection */
+    uint64_t index_sort;    /* CREATE INDEX sort memory of each connection */
+    uint64_t mmap;          /* mmap_size of each connection */
+    uint64_t input;         /* read buffer of each decode thread, 0 = mapped */
+    uint64_t queues;        /* batches of all decode threads */
+    int connections;
+    int readers;
+} MemoryPlan;
+
+MemoryPlan memory_plan;
+
+/* layout options */
+int clustered = 0;          /* child tables WITHOUT ROWID keyed on their parent id */
+int dict_encoding = 0;      /* tag keys, values and roles as dictionary ids */
+int fixed_coords = 0;       /* lat/lon as integers in 1E-7 degrees */
+int packed_ways = 0;        /* way node lists as packed BLOBs in ways */
+int node_ways = 0;          /* reverse index of the packed ways */
+int way_geometry = 0;       /* --geometry: GEOM_NONE, GEOM_WKB or GEOM_SPATIALITE */
+
+enum { GEOM_NONE, GEOM_WKB, GEOM_SPATIALITE };
+
+/* table and index statements per shard, filled by schema_build() */
+typedef struct {
+    char *tables[3];
+    char *indexes[3];
+    char *dict_tables;      /* dictionary tables and views, created after the import */
+    char *dict_indexes;
+    char *finish;           /* run on the complete database: node_ways, R*Tree */
+} Schema;
+
+Schema schema;
+
+/*
+** R*Tree indexes of --rtree, one per entity type and tag key or key=value.
+** Nodes are indexed by their location, ways by the bounding box of their
+** nodes and relations by the one of their node and way members. The boxes
+** of an entity type are collected and inserted in one go once its section
+** of the input has ended, see rtree_flush().
+*/
+typedef struct { int64_t id; int32_t min_lat, max_lat, min_lon, max_lon; } BoxEntry;
+
+typedef struct {
+    uint8_t type;           /* O5MREADER_DS_NODE, _WAY or _REL */
+    char *key, *value;      /* value NULL = any value */
+    char *table;
+    int joined;             /* filled by a join at the end, --locations=none */
+    BoxEntry *pending;      size_t n_pending, cap_pending;
+    uint64_t rows;
+    double seconds;
+} RtreeIndex;
+
+#define MAX_RTREES 32
+RtreeIndex rtrees[MAX_RTREES];
+int n_rtrees = 0;
+int store_locations = 0;    /* way or relation indexes are filled while decoding */
+int store_way_boxes = 0;    /* relation indexes need the boxes of all ways and relations */
+
+/*
+** Dictionary of one kind of strings. Ids count from 1 in first seen order,
+** the strings are kept in one buffer and found through an open addressing
+** hash table of ids. Decode threads share the dictionaries.
+*/
+typedef struct {
+    char *str;          size_t n_str, cap_str;
+    size_t *offs;       size_t n, cap_offs;     /* offs[id-1] */
+    size_t n_db;        /* entries already in the database, --update */
+    uint32_t *slots;    size_t mask;
+    pthread_mutex_t mutex;
+} Dict;
+
+Dict dict_keys, dict_values, dict_roles;
+
+static void check_db_rc( sqlite3 *h, int rc ) {
+    if( rc!=SQLITE_OK ) {
+        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(h));
+        sqlite3_close(h);
+        exit(1);
+    }
+}
+
+static void check_rc( int rc ) {
+    check_db_rc(db, rc);
+}
+
+/*
+** --memory: the page cache and mmap size of memory_plan. With bulk also the
+** bulk load profile: the page size of a new database, no rollback journal
+** and the file lock held until the connection is closed.
+*/
+static void apply_memory( sqlite3 *h, int bulk ) {
+    char *sql = sqlite3_mprintf("PRAGMA cache_size = -%lld; PRAGMA mmap_size = %lld;",
+        (long long)(memory_plan.cache/1024), (long long)memory_plan.mmap);
+    if( bulk ) sql = sqlite3_mprintf("%z PRAGMA page_size = %d; PRAGMA locking_mode = EXCLUSIVE; PRAGMA journal_mode = OFF;",
+        sql, O5M2SQLITE_PAGE_SIZE);
+    check_db_rc( h, sqlite3_exec(h,sql,NULL,NULL,NULL) );
+    sqlite3_free(sql);
+}
+
+/* open a database with the import pragmas set */
+static sqlite3 *open_db( const char *path ) {
+    sqlite3 *h;
+    int rc = sqlite3_open(path, &h);
+    check_db_rc( h, rc );
+    check_db_rc( h, sqlite3_exec(h,"PRAGMA synchronous = OFF",NULL,NULL,NULL) );
+    if( memory_plan.total ) apply_memory(h, 1);
+    else check_db_rc( h, sqlite3_exec(h,"PRAGMA journal_mode = MEMORY",NULL,NULL,NULL) );
+    check_db_rc( h, waynodes_register(h) );
+    return h;
+}
+
+/*
+** A batch holds the decoded rows of a run of datasets, one array per target
+** table. Strings (keys, values, roles) live in 'str' and are referenced by
+** offset, so a batch can be filled by one thread and written by another.
+*/
+typedef struct { int64_t id; int32_t lat, lon; } NodeRow;
+/* with --dict key, val and role are dictionary ids instead of offsets */
+typedef struct { int64_t id; uint32_t key, val; } TagRow;
+typedef struct { int64_t way_id; int64_t node_id; uint32_t local_order; } WayNodeRow;
+/* --ways=packed: nodes is the offset of the packed node list in str */
+typedef struct { int64_t id; uint32_t nodes, len; } WayRow;
+/* --geometry: geometry is the offset of the WKB or SpatiaLite BLOB in str */
+typedef struct { int64_t id; uint32_t geometry, len; } GeomRow;
+/*
+** Bounding box of an entity for the R*Tree indexes in mask. nds indexes n
+** node ids, then n_ways way ids in box_nds whose boxes are joined and
+** n_rels relation ids whose boxes are joined at the end.
+** shape asks for the geometry of a way with --geometry.
+*/
+enum { SHAPE_NONE, SHAPE_LINE, SHAPE_AREA };
+
+typedef struct {
+    int64_t id;
+    uint32_t nds, n, n_ways, n_rels;
+    uint32_t mask;
+    uint8_t type;
+    uint8_t shape;
+    int32_t min_lat, max_lat, min_lon, max_lon;
+} BoxRow;
+typedef struct { int64_t relation_id; int64_t ref; uint32_t role; uint32_t local_order; uint8_t type; } MemberRow;
+
+struct BatchQueue;
+
+typedef struct {
+    NodeRow *nodes;         size_t n_nodes, cap_nodes;
+    TagRow *node_tags;      size_t n_node_tags, cap_node_tags;
+    TagRow *way_tags;       size_t n_way_tags, cap_way_tags;
+    WayNodeRow *way_nodes;  size_t n_way_nodes, cap_way_nodes;
+    WayRow *ways;           size_t n_ways, cap_ways;
+    GeomRow *geoms;         size_t n_geoms, cap_geoms;
+    BoxRow *boxes;          size_t n_boxes, cap_boxes;
+    uint64_t *box_nds;      size_t n_box_nds, cap_box_nds;
+    TagRow *rel_tags;       size_t n_rel_tags, cap_rel_tags;
+    MemberRow *rel_members; size_t n_rel_members, cap_rel_members;
+    char *str;              size_t n_str, cap_str;
+    size_t rows;            /* rows over all tables */
+    size_t datasets;        /* nodes, ways and relations decoded */
+    size_t counts[3];       /* nodes, ways, relations */
+    size_t nds;             /* node refs of the ways */
+    uint64_t pos;           /* input offset after the batch */
+    uint8_t types;          /* bit 0/1/2: has nodes/ways/relations */
+    int last;               /* last batch of a chunk */
+    int error;              /* decoding failed, str holds the message */
+    int refs;               /* shard writers still using the batch */
+    struct BatchQueue *owner;
+} Batch;
+
+static double now( void ) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1E9;
+}
+
+static void *grow_array( void *p, size_t *cap, size_t need, size_t size ) {
+    size_t n = *cap ? *cap : 256;
+    while( n<need ) n *= 2;
+    p = realloc(p, n*size);
+    if( p==NULL ) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    *cap = n;
+    return p;
+}
+
+/* CPU time of the calling thread */
+static double cpu_now( void ) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec/1E9;
+}
+
+/*
+** Wall and CPU time per stage of the run: decode, insert, commit, every
+** index and R*Tree. The CPU time is the one of the thread that ran the
+** stage, a stage that runs on several threads adds up their times.
+*/
+typedef struct { char *name; double wall, cpu; uint64_t runs; } Stage;
+typedef struct { double wall, cpu; } StageClock;
+
+#define MAX_STAGES 128
+Stage stages[MAX_STAGES];
+int n_stages = 0;
+pthread_mutex_t stages_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void stage_start( StageClock *c ) {
+    c->wall = now();
+    c->cpu = cpu_now();
+}
+
+/* add the time since stage_start(c) to the stage name */
+static void stage_end( const char *name, const StageClock *c ) {
+    double wall = now()-c->wall, cpu = cpu_now()-c->cpu;
+    int i;
+
+    pthread_mutex_lock(&stages_mutex);
+    for( i=0; i<n_stages && strcmp(stages[i].name,name)!=0; i++ );
+    if( i==n_stages && n_stages<MAX_STAGES && (stages[i].name = strdup(name))!=NULL ) n_stages++;
+    if( i<n_stages ) {
+        stages[i].wall += wall;
+        stages[i].cpu += cpu;
+        stages[i].runs++;
+    }
+    pthread_mutex_unlock(&stages_mutex);
+}
+
+#define BATCH_ROW(b,t) \
+    ( ((b)->n_##t==(b)->cap_##t ? (void)((b)->t = grow_array((b)->t,&(b)->cap_##t,(b)->n_##t+1,sizeof(*(b)->t))) : (void)0), \
+      (b)->rows++, &(b)->t[(b)->n_##t++] )
+
+static Batch *batch_new( void ) {
+    Batch *b = calloc(1, sizeof(Batch));
+    if( b==NULL ) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return b;
+}
+
+static void batch_clear( Batch *b ) {
+    b->n_nodes = b->n_node_tags = b->n_way_tags = b->n_way_nodes = b->n_ways = b->n_rel_tags = b->n_rel_members = 0;
+    b->n_geoms = 0;
+    b->n_boxes = b->n_box_nds = 0;
+    b->types = 0;
+    b->n_str = b->rows = b->datasets = 0;
+    b->counts[0] = b->counts[1] = b->counts[2] = b->nds = 0;
+    b->last = b->error = 0;
+}
+
+static void batch_free( Batch *b ) {
+    free(b->nodes); free(b->node_tags); free(b->way_tags); free(b->way_nodes); free(b->ways); free(b->geoms);
+    free(b->boxes); free(b->box_nds);
+    free(b->rel_tags); free(b->rel_members); free(b->str);
+    free(b);
+}
+
+static uint32_t batch_str( Batch *b, const char *s ) {
+    size_t len = strlen(s)+1;
+    uint32_t off = b->n_str;
+    if( b->n_str+len > b->cap_str ) b->str = grow_array(b->str, &b->cap_str, b->n_str+len, 1);
+    memcpy(b->str+b->n_str, s, len);
+    b->n_str += len;
+    return off;
+}
+
+static void batch_set_error( Batch *b, O5mreader *reader ) {
+    b->n_str = 0;
+    batch_str(b, o5mreader_strerror(reader->errCode));
+    b->error = 1;
+}
+
+static void dict_init( Dict *d ) {
+    memset(d, 0, sizeof(Dict));
+    pthread_mutex_init(&d->mutex, NULL);
+}
+
+static void dict_free( Dict *d ) {
+    free(d->str);
+    free(d->offs);
+    free(d->slots);
+    pthread_mutex_destroy(&d->mutex);
+}
+
+/* FNV-1a */
+static uint64_t str_hash( const char *s ) {
+    uint64_t h = 14695981039346656037ULL;
+    while( *s ) h = (h ^ (uint8_t)*s++) * 1099511628211ULL;
+    return h;
+}
+
+static void dict_rehash( Dict *d ) {
+    size_t size = d->mask ? 2*(d->mask+1) : 4096;
+    size_t i, j;
+    free(d->slots);
+    d->slots = calloc(size, sizeof(uint32_t));
+    if( d->slots==NULL ) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    d->mask = size-1;
+    for( i=0; i<d->n; i++ ) {
+        for( j=str_hash(d->str+d->offs[i]) & d->mask; d->slots[j]; j=(j+1) & d->mask );
+        d->slots[j] = i+1;
+    }
+}
+
+/* id of s, added to the dictionary if it is new */
+static uint32_t dict_intern( Dict *d, const char *s ) {
+    size_t i, len;
+    uint32_t id;
+
+    pthread_mutex_lock(&d->mutex);
+    if( 2*(d->n+1) > d->mask ) dict_rehash(d);
+    for( i=str_hash(s) & d->mask; (id = d->slots[i])!=0; i=(i+1) & d->mask )
+        if( strcmp(d->str+d->offs[id-1], s)==0 ) {
+            pthread_mutex_unlock(&d->mutex);
+            return id;
+        }
+    len = strlen(s)+1;
+    if( d->n_str+len > d->cap_str ) d->str = grow_array(d->str, &d->cap_str, d->n_str+len, 1);
+    if( d->n==d->cap_offs ) d->offs = grow_array(d->offs, &d->cap_offs, d->n+1, sizeof(size_t));
+    memcpy(d->str+d->n_str, s, len);
+    d->offs[d->n] = d->n_str;
+    d->n_str += len;
+    id = d->slots[i] = ++d->n;
+    pthread_mutex_unlock(&d->mutex);
+    return id;
+}
+
+/*
+** Ids of recently seen tag pairs of one decode thread, by the pair's
+** identity in the o5m string table: a repeated pair costs no hashing.
+** Must be cleared whenever a new reader is opened.
+*/
+#define PAIR_CACHE_SIZE 16384
+
+typedef struct { uint64_t pair; uint32_t key, val; } PairCacheEntry;
+typedef struct { PairCacheEntry e[PAIR_CACHE_SIZE]; } PairCache;
+
+static PairCache *pair_cache_new( void ) {
+    PairCache *c = calloc(1, sizeof(PairCache));
+    if( c==NULL ) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return c;
+}
+
+static void intern_tag( PairCache *cache, const O5mreaderTag *t, TagRow *tag ) {
+    PairCacheEntry *c = &cache->e[t->pair & (PAIR_CACHE_SIZE-1)];
+    if( t->pair && c->pair==t->pair ) {
+        tag->key = c->key;
+        tag->val = c->val;
+        return;
+    }
+    tag->key = dict_intern(&dict_keys, t->key);
+    tag->val = dict_intern(&dict_values, t->val);
+    if( t->pair ) {
+        c->pair = t->pair;
+        c->key = tag->key;
+        c->val = tag->val;
+    }
+}
+
+static void batch_tags( Batch *b, TagRow **rows, size_t *n, size_t *cap, const O5mreaderEntity *e, PairCache *cache ) {
+    size_t i;
+    TagRow *tag;
+    if( *n+e->tagCount > *cap ) *rows = grow_array(*rows, cap, *n+e->tagCount, sizeof(TagRow));
+    for( i=0; i<e->tagCount; i++ ) {
+        tag = &(*rows)[(*n)++];
+        tag->id = e->ds.id;
+        if( dict_encoding ) intern_tag(cache, &e->tags[i], tag);
+        else {
+            tag->key = batch_str(b,e->tags[i].key);
+            tag->val = batch_str(b,e->tags[i].val);
+        }
+    }
+    b->rows += e->tagCount;
+}
+
+/*
+** Node location store. The writer fills it with the nodes in file order, so
+** the bounding boxes of the ways that follow them in an o5m file can be
+** computed while the ways are written, see locate_batch(). Sparse: entries
+** sorted by id, for extracts. Dense: one location per id in an anonymous
+** mmap, for planets; pages of unused id ranges are never touched. Auto
+** starts sparse and turns dense once the ids fill half of their range.
+*/
+enum { LOC_NONE, LOC_AUTO, LOC_SPARSE, LOC_DENSE };
+
+/* lat and lon with the sign bit flipped: 0 = no location */
+typedef struct { uint32_t lat, lon; } Location;
+typedef struct { int64_t id; Location loc; } SparseLocation;
+
+typedef struct {
+    int mode;
+    SparseLocation *sparse; size_t n, cap;
+    int sorted;
+    Location *dense;        size_t dense_cap;   /* ids 0 .. dense_cap-1 */
+    int64_t min_id, max_id;
+    uint64_t stored, missing;
+    uint64_t negative;      /* negative ids in the sparse array of the dense store */
+} LocStore;
+
+LocStore locations = { LOC_AUTO };
+
+static const char *loc_mode_name( int mode ) {
+    switch( mode ) {
+        case LOC_AUTO:   return "auto";
+        case LOC_SPARSE: return "sparse";
+        case LOC_DENSE:  return "dense";
+        default:         return "none";
+    }
+}
+
+static void loc_dense_grow( LocStore *s, int64_t id ) {
+    size_t cap = s->dense_cap ? s->dense_cap : 1<<20;
+    void *p;
+
+    while( cap<=(uint64_t)id ) cap *= 2;
+#if !defined(_WIN32)
+    if( s->dense==NULL )
+        p = mmap(NULL, cap*sizeof(Location), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+#ifdef MREMAP_MAYMOVE
+    else p = mremap(s->dense, s->dense_cap*sizeof(Location), cap*sizeof(Location), MREMAP_MAYMOVE);
+#else
+    else {
+        p = mmap(NULL, cap*sizeof(Location), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+        if( p!=MAP_FAILED ) {
+            memcpy(p, s->dense, s->dense_cap*sizeof(Location));
+            munmap(s->dense, s->dense_cap*sizeof(Location));
+        }
+    }
+#endif
+    if( p==MAP_FAILED ) p = NULL;
+#else
+    p = realloc(s->dense, cap*sizeof(Location));
+    if( p ) memset((Location *)p+s->dense_cap, 0, (cap-s->dense_cap)*sizeof(Location));
+#endif
+    if( p==NULL ) {
+        fprintf(stderr, "out of memory for the locations of node ids up to %lld\n", (long long)id);
+        exit(1);
+    }
+    s->dense = p;
+    s->dense_cap = cap;
+}
+
+/* move the sparse entries into the dense array, negative ids stay sparse */
+static void loc_make_dense( LocStore *s ) {
+    size_t i, n = 0;
+    loc_dense_grow(s, s->max_id);
+    for( i=0; i<s->n; i++ ) {
+        if( s->sparse[i].id<0 ) {
+            s->sparse[n++] = s->sparse[i];
+            s->negative++;
+        }
+        else s->dense[s->sparse[i].id] = s->sparse[i].loc;
+    }
+    s->n = n;
+    if( n==0 ) {
+        free(s->sparse);
+        s->sparse = NULL;
+        s->cap = 0;
+    }
+    s->mode = LOC_DENSE;
+}
+
+static void loc_put( LocStore *s, int64_t id, int32_t lat, int32_t lon ) {
+    Location loc = { (uint32_t)lat ^ 0x80000000u, (uint32_t)lon ^ 0x80000000u };
+
+    if( s->stored==0 || id<s->min_id ) s->min_id = id;
+    if( s->stored==0 || id>s->max_id ) s->max_id = id;
+    s->stored++;
+    if( s->mode==LOC_AUTO && s->n==s->cap && s->min_id>=0 && s->n>=(1<<16) && (uint64_t)s->n*2>(uint64_t)s->max_id )
+        loc_make_dense(s);
+    if( s->mode==LOC_DENSE ) {
+        if( id>=0 ) {
+            if( (uint64_t)id>=s->dense_cap ) loc_dense_grow(s, id);
+            s->dense[id] = loc;
+            return;
+        }
+        // negative ids, as of new objects in edited extracts, go into the sparse array
+        s->negative++;
+    }
+    if( s->n==s->cap ) s->sparse = grow_array(s->sparse, &s->cap, s->n+1, sizeof(SparseLocation));
+    if( s->n>0 && id<=s->sparse[s->n-1].id ) s->sorted = 0;
+    else if( s->n==0 ) s->sorted = 1;
+    s->sparse[s->n].id = id;
+    s->sparse[s->n].loc = loc;
+    s->n++;
+}
+
+static int cmp_sparse_location( const void *a, const void *b ) {
+    int64_t ia = ((const SparseLocation *)a)->id, ib = ((const SparseLocation *)b)->id;
+    return ia<ib ? -1 : ia>ib;
+}
+
+static int loc_get( LocStore *s, int64_t id, int32_t *lat, int32_t *lon ) {
+    Location loc = { 0, 0 };
+    size_t lo = 0, hi = s->n, mid;
+
+    if( s->mode==LOC_DENSE && id>=0 ) {
+        if( (uint64_t)id<s->dense_cap ) loc = s->dense[id];
+    }
+    else {
+        if( !s->sorted ) {
+            qsort(s->sparse, s->n, sizeof(SparseLocation), cmp_sparse_location);
+            s->sorted = 1;
+        }
+        while( lo<hi ) {
+            mid = lo + (hi-lo)/2;
+            if( s->sparse[mid].id<id ) lo = mid+1;
+            else hi = mid;
+        }
+        if( lo<s->n && s->sparse[lo].id==id ) loc = s->sparse[lo].loc;
+    }
+    if( loc.lat==0 ) return 0;
+    *lat = (int32_t)(loc.lat ^ 0x80000000u);
+    *lon = (int32_t)(loc.lon ^ 0x80000000u);
+    return 1;
+}
+
+static void loc_free( LocStore *s ) {
+#if !defined(_WIN32)
+    if( s->dense ) munmap(s->dense, s->dense_cap*sizeof(Location));
+#else
+    free(s->dense);
+#endif
+    free(s->sparse);
+    s->dense = NULL;
+    s->sparse = NULL;
+}
+
+/*
+** Bounding boxes of ways by id, filled in file order like the node
+** location store, for the boxes of relations with way members. Boxes put
+** in ascending id order are packed into blocks of BOX_BLOCK entries, each
+** entry as varints: the id difference to the previous entry, the zigzag
+** encoded differences of min_lat and min_lon to the previous entry and the
+** height and width of the box, about 10 to 15 bytes per way instead of 24.
+** A block index of first ids finds the block of an id, the block
+** decoded last is kept for the member ways of the following relations.
+** Boxes out of id order go into a sorted array.
+*/
+#define BOX_BLOCK 32
+
+typedef struct { int64_t id; size_t offset; } BoxBlock;
+
+typedef struct {
+    uint8_t *data;          size_t n_data, cap_data;
+    BoxBlock *blocks;       size_t n_blocks, cap_blocks;
+    uint64_t n;             /* boxes in the blocks */
+    BoxEntry last;          /* box put into the blocks last */
+    BoxEntry *boxes;        size_t n_boxes, cap_boxes;     /* out of order */
+    int unsorted;
+    BoxEntry decoded[BOX_BLOCK];
+    size_t n_decoded, decoded_block;
+    uint64_t missing;       /* way members without a box */
+} BoxStore;
+
+BoxStore way_boxes;
+
+static int cmp_box_entry( const void *a, const void *b ) {
+    int64_t ia = ((const BoxEntry *)a)->id, ib = ((const BoxEntry *)b)->id;
+    return ia<ib ? -1 : ia>ib;
+}
+
+static uint8_t *put_varint( uint8_t *p, uint64_t v ) {
+    while( v>=0x80 ) {
+        *p++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static const uint8_t *get_varint( const uint8_t *p, uint64_t *v ) {
+    int shift = 0;
+    *v = 0;
+    do {
+        *v |= (uint64_t)(*p & 0x7f) << shift;
+        shift += 7;
+    } while( *p++ & 0x80 );
+    return p;
+}
+
+static uint64_t zigzag( int64_t d ) { return ((uint64_t)d << 1) ^ (uint64_t)(d >> 63); }
+static int64_t unzigzag( uint64_t z ) { return (int64_t)(z >> 1) ^ -(int64_t)(z & 1); }
+
+static void box_put( BoxStore *s, const BoxEntry *e ) {
+    const BoxEntry *prev = &s->last;
+    uint8_t *p;
+
+    if( s->n>0 && e->id<=s->last.id ) {
+        if( s->n_boxes==s->cap_boxes ) s->boxes = grow_array(s->boxes, &s->cap_boxes, s->n_boxes+1, sizeof(BoxEntry));
+        if( s->n_boxes>0 && e->id<=s->boxes[s->n_boxes-1].id ) s->unsorted = 1;
+        s->boxes[s->n_boxes++] = *e;
+        return;
+    }
+    if( s->n%BOX_BLOCK==0 ) {
+        if( s->n_blocks==s->cap_blocks ) s->blocks = grow_array(s->blocks, &s->cap_blocks, s->n_blocks+1, sizeof(BoxBlock));
+        s->blocks[s->n_blocks].id = e->id;
+        s->blocks[s->n_blocks++].offset = s->n_data;
+        prev = NULL;
+    }
+    if( s->n_data+50 > s->cap_data ) s->data = grow_array(s->data, &s->cap_data, s->n_data+50, 1);
+    p = s->data+s->n_data;
+    p = put_varint(p, prev ? (uint64_t)(e->id-prev->id) : 0);
+    p = put_varint(p, zigzag((int64_t)e->min_lat - (prev ? prev->min_lat : 0)));
+    p = put_varint(p, zigzag((int64_t)e->min_lon - (prev ? prev->min_lon : 0)));
+    p = put_varint(p, (uint32_t)e->max_lat - (uint32_t)e->min_lat);
+    p = put_varint(p, (uint32_t)e->max_lon - (uint32_t)e->min_lon);
+    s->n_data = p - s->data;
+    s->last = *e;
+    s->n++;
+    // the decoded copy of the last block is out of date
+    if( s->n_decoded && s->decoded_block==s->n_blocks-1 ) s->n_decoded = 0;
+}
+
+static void box_decode_block( BoxStore *s, size_t k ) {
+    const uint8_t *p = s->data+s->blocks[k].offset;
+    BoxEntry *e, *prev = NULL;
+    uint64_t v;
+    size_t i, n = k+1<s->n_blocks ? BOX_BLOCK : s->n-k*BOX_BLOCK;
+
+    for( i=0; i<n; i++ ) {
+        e = &s->decoded[i];
+        p = get_varint(p, &v);
+        e->id = prev ? prev->id+(int64_t)v : s->blocks[k].id;
+        p = get_varint(p, &v);
+        e->min_lat = (int32_t)((prev ? prev->min_lat : 0) + unzigzag(v));
+        p = get_varint(p, &v);
+        e->min_lon = (int32_t)((prev ? prev->min_lon : 0) + unzigzag(v));
+        p = get_varint(p, &v);
+        e->max_lat = (int32_t)((uint32_t)e->min_lat + (uint32_t)v);
+        p = get_varint(p, &v);
+        e->max_lon = (int32_t)((uint32_t)e->min_lon + (uint32_t)v);
+        prev = e;
+    }
+    s->n_decoded = n;
+    s->decoded_block = k;
+}
+
+/* index of the first of n entries of size bytes at base whose id is not below id */
+static size_t lower_bound_id( const void *base, size_t n, size_t size, int64_t id ) {
+    size_t lo = 0, hi = n, mid;
+    while( lo<hi ) {
+        mid = lo + (hi-lo)/2;
+        if( *(const int64_t *)((const char *)base+mid*size)<id ) lo = mid+1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static int box_get( BoxStore *s, int64_t id, BoxEntry *e ) {
+    size_t i;
+
+    if( s->n_boxes ) {
+        if( s->unsorted ) {
+            qsort(s->boxes, s->n_boxes, sizeof(BoxEntry), cmp_box_entry);
+            s->unsorted = 0;
+        }
+        i = lower_bound_id(s->boxes, s->n_boxes, sizeof(BoxEntry), id);
+        if( i<s->n_boxes && s->boxes[i].id==id ) {
+            *e = s->boxes[i];
+            return 1;
+        }
+    }
+    if( s->n==0 || id<s->blocks[0].id || id>s->last.id ) return 0;
+    // the block is the last one starting at or below id
+    i = lower_bound_id(s->blocks, s->n_blocks, sizeof(BoxBlock), id+1) - 1;
+    if( s->n_decoded==0 || s->decoded_block!=i ) box_decode_block(s, i);
+    i = lower_bound_id(s->decoded, s->n_decoded, sizeof(BoxEntry), id);
+    if( i==s->n_decoded || s->decoded[i].id!=id ) return 0;
+    *e = s->decoded[i];
+    return 1;
+}
+
+static size_t box_bytes( const BoxStore *s ) {
+    return s->cap_data + s->cap_blocks*sizeof(BoxBlock) + s->cap_boxes*sizeof(BoxEntry);
+}
+
+static void box_free( BoxStore *s ) {
+    free(s->data);
+    free(s->blocks);
+    free(s->boxes);
+    s->data = NULL;
+    s->blocks = NULL;
+    s->boxes = NULL;
+}
+
+/*
+** Boxes of relations for relation R*Trees. The box of a relation's node
+** and way members is known once the relation is decoded, the boxes of its
+** member relations are not: those may come later in the input and may
+** contain the relation in turn. So every relation's box and the pairs of
+** relation and member relation are kept until the input has ended, when
+** resolve_relation_boxes() joins the member relations.
+*/
+typedef struct {
+    BoxEntry box;
+    uint32_t mask;          /* R*Tree indexes of the relation */
+    uint8_t found;          /* box has at least one member location */
+    uint8_t state;          /* REL_QUEUED and REL_GROWN while resolving */
+} RelationBox;
+
+#define REL_QUEUED 1
+#define REL_GROWN 2
+
+/* a relation member of a relation, ids and then indexes of boxes */
+typedef struct { int64_t parent, child; } RelationEdge;
+
+typedef struct {
+    RelationBox *boxes;     size_t n, cap;
+    int unsorted;
+    RelationEdge *edges;    size_t n_edges, cap_edges;
+    uint64_t missing;       /* member relations not in the input */
+} RelationStore;
+
+RelationStore relation_boxes;
+
+static void relation_put( RelationStore *s, const BoxEntry *e, uint32_t mask, int found ) {
+    RelationBox *r;
+    if( s->n==s->cap ) s->boxes = grow_array(s->boxes, &s->cap, s->n+1, sizeof(RelationBox));
+    if( s->n>0 && e->id<=s->boxes[s->n-1].box.id ) s->unsorted = 1;
+    r = &s->boxes[s->n++];
+    r->box = *e;
+    r->mask = mask;
+    r->found = found!=0;
+    r->state = 0;
+}
+
+static void relation_edge( RelationStore *s, int64_t parent, int64_t child ) {
+    if( s->n_edges==s->cap_edges ) s->edges = grow_array(s->edges, &s->cap_edges, s->n_edges+1, sizeof(RelationEdge));
+    s->edges[s->n_edges].parent = parent;
+    s->edges[s->n_edges++].child = child;
+}
+
+/* index of the box of relation id, -1 if there is none */
+static int64_t relation_find( RelationStore *s, int64_t id ) {
+    size_t i;
+    if( s->unsorted ) {
+        qsort(s->boxes, s->n, sizeof(RelationBox), cmp_box_entry);
+        s->unsorted = 0;
+    }
+    i = lower_bound_id(s->boxes, s->n, sizeof(RelationBox), id);
+    return i<s->n && s->boxes[i].box.id==id ? (int64_t)i : -1;
+}
+
+/* extend r by e, returns whether r has grown */
+static int relation_grow( RelationBox *r, const BoxEntry *e ) {
+    int grown = 0;
+    if( !r->found ) {
+        r->box.min_lat = e->min_lat; r->box.max_lat = e->max_lat;
+        r->box.min_lon = e->min_lon; r->box.max_lon = e->max_lon;
+        r->found = 1;
+        return 1;
+    }
+    if( e->min_lat<r->box.min_lat ) { r->box.min_lat = e->min_lat; grown = 1; }
+    if( e->max_lat>r->box.max_lat ) { r->box.max_lat = e->max_lat; grown = 1; }
+    if( e->min_lon<r->box.min_lon ) { r->box.min_lon = e->min_lon; grown = 1; }
+    if( e->max_lon>r->box.max_lon ) { r->box.max_lon = e->max_lon; grown = 1; }
+    return grown;
+}
+
+static void rtree_add( int k, const BoxEntry *e ) {
+    RtreeIndex *r = &rtrees[k];
+    if( r->n_pending==r->cap_pending ) r->pending = grow_array(r->pending, &r->cap_pending, r->n_pending+1, sizeof(BoxEntry));
+    r->pending[r->n_pending++] = *e;
+}
+
+/*
+** Join the boxes of member relations into their relations and hand the
+** relation boxes to the R*Tree indexes. A relation whose box grows passes
+** it on to the relations it is a member of, until no box changes. Boxes
+** only grow, so this ends on cycles of relations as well, every relation
+** of a cycle gets the box of all of it.
+*/
+static void resolve_relation_boxes( void ) {
+    RelationStore *s = &relation_boxes;
+    size_t *first, *parents, *queue, i, j, head = 0, n_queued = 0;
+    uint64_t nested = 0;
+    int64_t c, p;
+    StageClock clock;
+    int k;
+
+    if( !store_way_boxes ) return;
+    stage_start(&clock);
+    // the parents of relation i are parents[first[i] .. first[i+1]-1]
+    first = calloc(s->n+1, sizeof(size_t));
+    parents = malloc((s->n_edges+1)*sizeof(size_t));
+    queue = malloc((s->n+1)*sizeof(size_t));
+    if( first==NULL || parents==NULL || queue==NULL ) {
+        fprintf(stderr, "out of memory for the relation boxes\n");
+        exit(1);
+    }
+    for( j=0; j<s->n_edges; j++ ) {
+        c = relation_find(s, s->edges[j].child);
+        p = relation_find(s, s->edges[j].parent);
+        if( c<0 ) s->missing++;
+        s->edges[j].child = p<0 ? -1 : c;
+        s->edges[j].parent = p;
+        if( c>=0 && p>=0 ) first[c+1]++;
+    }
+    for( i=0; i<s->n; i++ ) first[i+1] += first[i];
+    for( j=0; j<s->n_edges; j++ )
+        if( s->edges[j].child>=0 ) parents[first[s->edges[j].child]++] = s->edges[j].parent;
+    for( i=s->n; i>0; i-- ) first[i] = first[i-1];
+    first[0] = 0;
+
+    for( i=0; i<s->n; i++ ) {
+        if( !s->boxes[i].found || first[i]==first[i+1] ) continue;
+        s->boxes[i].state |= REL_QUEUED;
+        queue[n_queued++] = i;
+    }
+    while( n_queued ) {
+        i = queue[head];
+        head = (head+1) % s->n;
+        n_queued--;
+        s->boxes[i].state &= ~REL_QUEUED;
+        for( j=first[i]; j<first[i+1]; j++ ) {
+            RelationBox *r = &s->boxes[parents[j]];
+            if( !relation_grow(r, &s->boxes[i].box) ) continue;
+            r->state |= REL_GROWN;
+            if( (r->state & REL_QUEUED) || first[parents[j]]==first[parents[j]+1] ) continue;
+            r->state |= REL_QUEUED;
+            queue[(head+n_queued++) % s->n] = parents[j];
+        }
+    }
+
+    for( i=0; i<s->n; i++ ) {
+        if( s->boxes[i].state & REL_GROWN ) nested++;
+        if( !s->boxes[i].found ) continue;
+        for( k=0; k<n_rtrees; k++ )
+            if( s->boxes[i].mask & 1u<<k ) rtree_add(k, &s->boxes[i].box);
+    }
+    stage_end("relation boxes", &clock);
+    fprintf(stderr, "relation boxes: %llu relations, %.1f MB, %llu member relations, %llu relations grown by them, %llu not in the input\n",
+        (unsigned long long)s->n, (s->cap*sizeof(RelationBox) + s->cap_edges*sizeof(RelationEdge))/1048576.0,
+        (unsigned long long)s->n_edges, (unsigned long long)nested, (unsigned long long)s->missing);
+    free(first);
+    free(parents);
+    free(queue);
+    free(s->boxes);
+    free(s->edges);
+    s->boxes = NULL;
+    s->edges = NULL;
+}
+
+/* bitmask of the --rtree indexes filled while decoding that e belongs into */
+static uint32_t rtree_match( const O5mreaderEntity *e ) {
+    uint32_t mask = 0;
+    size_t i;
+    int r;
+
+    for( r=0; r<n_rtrees; r++ ) {
+        if( rtrees[r].type!=e->ds.type || rtrees[r].joined ) continue;
+        if( strcmp(rtrees[r].key,"*")==0 ) {
+            mask |= 1u<<r;
+            continue;
+        }
+        for( i=0; i<e->tagCount; i++ ) {
+            if( strcmp(e->tags[i].key,rtrees[r].key)!=0 ) continue;
+            if( rtrees[r].value==NULL || strcmp(e->tags[i].val,rtrees[r].value)==0 ) mask |= 1u<<r;
+        }
+    }
+    return mask;
+}
+
+static void box_refs( Batch *b, uint64_t id ) {
+    if( b->n_box_nds==b->cap_box_nds ) b->box_nds = grow_array(b->box_nds, &b->cap_box_nds, b->n_box_nds+1, sizeof(uint64_t));
+    b->box_nds[b->n_box_nds++] = id;
+}
+
+/*
+** --geometry: closed ways with at least 4 nodes are polygons if they have
+** area=yes or one of area_keys, unless area=no, everything else is a line.
+*/
+static const char *area_keys[] = {
+    "amenity", "building", "landuse", "leisure", "natural", "place", "shop", "tourism", "water", NULL
+};
+
+static int way_shape( const O5mreaderEntity *e ) {
+    int area = 0;
+    size_t i, k;
+
+    if( e->ndCount<4 || e->nds[0]!=e->nds[e->ndCount-1] ) return SHAPE_LINE;
+    for( i=0; i<e->tagCount; i++ ) {
+        if( strcmp(e->tags[i].key,"area")==0 ) return strcmp(e->tags[i].val,"no")==0 ? SHAPE_LINE : SHAPE_AREA;
+        for( k=0; area_keys[k] && !area; k++ ) area = strcmp(e->tags[i].key,area_keys[k])==0;
+    }
+    return area ? SHAPE_AREA : SHAPE_LINE;
+}
+
+/* a bounding box row for an entity in R*Tree indexes, and for every way and relation if relations need them */
+static void batch_box( Batch *b, const O5mreaderEntity *e ) {
+    uint32_t mask = rtree_match(e);
+    int shape = e->ds.type==O5MREADER_DS_WAY && way_geometry ? way_shape(e) : SHAPE_NONE;
+    BoxRow *box;
+    size_t i;
+
+    // --update recomputes the boxes from the tables at the end
+    if( updating ) return;
+    if( mask==0 && shape==SHAPE_NONE && !(e->ds.type!=O5MREADER_DS_NODE && store_way_boxes) ) return;
+    box = BATCH_ROW(b,boxes);
+    box->id = e->ds.id;
+    box->type = e->ds.type;
+    box->mask = mask;
+    box->shape = shape;
+    box->nds = b->n_box_nds;
+    box->n = box->n_ways = box->n_rels = 0;
+    switch( e->ds.type ) {
+        case O5MREADER_DS_NODE:
+            box->min_lat = box->max_lat = e->ds.lat;
+            box->min_lon = box->max_lon = e->ds.lon;
+            break;
+        case O5MREADER_DS_WAY:
+            if( b->n_box_nds+e->ndCount > b->cap_box_nds )
+                b->box_nds = grow_array(b->box_nds, &b->cap_box_nds, b->n_box_nds+e->ndCount, sizeof(uint64_t));
+            memcpy(b->box_nds+b->n_box_nds, e->nds, e->ndCount*sizeof(uint64_t));
+            b->n_box_nds += e->ndCount;
+            box->n = e->ndCount;
+            break;
+        default:
+            for( i=0; i<e->memberCount; i++ )
+                if( e->members[i].type==O5MREADER_DS_NODE ) box_refs(b, e->members[i].id);
+            box->n = b->n_box_nds - box->nds;
+            for( i=0; i<e->memberCount; i++ )
+                if( e->members[i].type==O5MREADER_DS_WAY ) box_refs(b, e->members[i].id);
+            box->n_ways = b->n_box_nds - box->nds - box->n;
+            if( !store_way_boxes ) break;
+            for( i=0; i<e->memberCount; i++ )
+                if( e->members[i].type==O5MREADER_DS_REL ) box_refs(b, e->members[i].id);
+            box->n_rels = b->n_box_nds - box->nds - box->n - box->n_ways;
+            break;
+    }
+}
+
+static void box_extend( BoxRow *box, int found, int32_t min_lat, int32_t max_lat, int32_t min_lon, int32_t max_lon ) {
+    if( !found || min_lat<box->min_lat ) box->min_lat = min_lat;
+    if( !found || max_lat>box->max_lat ) box->max_lat = max_lat;
+    if( !found || min_lon<box->min_lon ) box->min_lon = min_lon;
+    if( !found || max_lon>box->max_lon ) box->max_lon = max_lon;
+}
+
+/* join the locations of a way's nodes or a relation's node and way members into its box */
+static int box_locate( const Batch *b, BoxRow *box ) {
+    const uint64_t *ids = b->box_nds+box->nds;
+    BoxEntry e;
+    int32_t lat, lon;
+    uint32_t j;
+    int found = 0;
+
+    for( j=0; j<box->n; j++ ) {
+        if( !loc_get(&locations, ids[j], &lat, &lon) ) {
+            locations.missing++;
+            continue;
+        }
+        box_extend(box, found++, lat, lat, lon, lon);
+    }
+    for( ; j<box->n+box->n_ways; j++ ) {
+        if( !box_get(&way_boxes, ids[j], &e) ) {
+            way_boxes.missing++;
+            continue;
+        }
+        box_extend(box, found++, e.min_lat, e.max_lat, e.min_lon, e.max_lon);
+    }
+    return found;
+}
+
+/* --geometry: ways written as lines and polygons, ways left out, nodes without location */
+typedef struct {
+    uint64_t lines, polygons, incomplete, empty, missing;
+} GeometryStats;
+
+GeometryStats geometry_stats;
+
+static char *put_uint32( char *p, uint32_t v ) { memcpy(p, &v, 4); return p+4; }
+static char *put_double( char *p, double v ) { memcpy(p, &v, 8); return p+8; }
+
+/*
+** --geometry: append the LineString or Polygon of a way to its batch as a
+** GeomRow and fill in its box like box_locate(). Nodes without location
+** are left out and counted, a polygon whose first or last node is missing
+** becomes a line and a way with less than two located nodes gets no row.
+** The BLOB is WKB or, with --geometry=spatialite, a SpatiaLite geometry
+** (SRID 4326 and the bounding box in front of the WKB body), both in the
+** byte order of the machine. Called by locate_batch(), on one thread at a
+** time, which owns the scratch array of the points.
+*/
+static int geometry_locate( Batch *b, BoxRow *box ) {
+    static int32_t *points;
+    static size_t cap_points;
+    static const uint16_t byte_order = 1;
+    const uint64_t *ids = b->box_nds+box->nds;
+    int spatialite = way_geometry==GEOM_SPATIALITE;
+    int32_t lat, lon;
+    uint32_t j, n = 0;
+    int ends = 0, area;
+    size_t size;
+    GeomRow *g;
+    char *p;
+
+    if( 2*(size_t)box->n > cap_points ) points = grow_array(points, &cap_points, 2*(size_t)box->n, sizeof(int32_t));
+    for( j=0; j<box->n; j++ ) {
+        if( !loc_get(&locations, ids[j], &lat, &lon) ) {
+            locations.missing++;
+            geometry_stats.missing++;
+            continue;
+        }
+        if( j==0 || j==box->n-1 ) ends++;
+        box_extend(box, n, lat, lat, lon, lon);
+        points[2*n] = lat;
+        points[2*n+1] = lon;
+        n++;
+    }
+    if( n<2 ) {
+        geometry_stats.empty++;
+        return n;
+    }
+    if( n<box->n ) geometry_stats.incomplete++;
+    area = box->shape==SHAPE_AREA && ends==2 && n>=4;
+    if( area ) geometry_stats.polygons++;
+    else geometry_stats.lines++;
+
+    size = (spatialite ? 48 : 9) + (area ? 4 : 0) + 16*(size_t)n;
+    if( b->n_str+size > b->cap_str ) b->str = grow_array(b->str, &b->cap_str, b->n_str+size, 1);
+    g = BATCH_ROW(b,geoms);
+    g->id = box->id;
+    g->geometry = b->n_str;
+    g->len = size;
+    p = b->str+b->n_str;
+    if( spatialite ) {
+        *p++ = 0x00;
+        *p++ = *(const uint8_t *)&byte_order;
+        p = put_uint32(p, 4326);
+        p = put_double(p, box->min_lon/1E7);
+        p = put_double(p, box->min_lat/1E7);
+        p = put_double(p, box->max_lon/1E7);
+        p = put_double(p, box->max_lat/1E7);
+        *p++ = 0x7c;
+    }
+    else *p++ = *(const uint8_t *)&byte_order;
+    p = put_uint32(p, area ? 3 : 2);
+    if( area ) p = put_uint32(p, 1);
+    p = put_uint32(p, n);
+    for( j=0; j<n; j++ ) {
+        p = put_double(p, points[2*j+1]/1E7);
+        p = put_double(p, points[2*j]/1E7);
+    }
+    if( spatialite ) *p++ = (char)0xfe;
+    b->n_str += size;
+    return n;
+}
+
+/*
+** Store the node locations of a batch, complete its bounding boxes and add
+** them to their R*Tree indexes, called for every batch in file order.
+** Entities none of whose nodes or members are known get no box. Relation
+** boxes wait in relation_boxes for the boxes of their member relations.
+*/
+static void locate_batch( Batch *b ) {
+    BoxRow *box;
+    BoxEntry e;
+    size_t i;
+    uint32_t j;
+    int k, found;
+
+    if( store_locations )
+        for( i=0; i<b->n_nodes; i++ ) loc_put(&locations, b->nodes[i].id, b->nodes[i].lat, b->nodes[i].lon);
+    for( i=0; i<b->n_boxes; i++ ) {
+        box = &b->boxes[i];
+        if( box->shape!=SHAPE_NONE ) found = geometry_locate(b, box);
+        else found = box->type==O5MREADER_DS_NODE || box_locate(b, box);
+        e.id = box->id;
+        e.min_lat = box->min_lat;
+        e.max_lat = box->max_lat;
+        e.min_lon = box->min_lon;
+        e.max_lon = box->max_lon;
+        if( box->type==O5MREADER_DS_REL && store_way_boxes ) {
+            relation_put(&relation_boxes, &e, box->mask, found);
+            for( j=box->n+box->n_ways; j<box->n+box->n_ways+box->n_rels; j++ )
+                relation_edge(&relation_boxes, box->id, b->box_nds[box->nds+j]);
+            continue;
+        }
+        if( !found ) continue;
+        if( box->type==O5MREADER_DS_WAY && store_way_boxes ) box_put(&way_boxes, &e);
+        for( k=0; k<n_rtrees; k++ )
+            if( box->mask & 1u<<k ) rtree_add(k, &e);
+    }
+}
+
+/* turn a decoded entity into batch rows, cache is only used with --dict */
+static void batch_entity( Batch *b, const O5mreaderEntity *e, PairCache *cache ) {
+    size_t i;
+    NodeRow *node;
+    WayNodeRow *way_node;
+    WayRow *way;
+    MemberRow *member;
+
+    switch ( e->ds.type ) {
+        // Data set is node, lon and lat are ints in 1E+7 * degree units
+        case O5MREADER_DS_NODE:
+            node = BATCH_ROW(b,nodes);
+            node->id = e->ds.id;
+            node->lat = e->ds.lat;
+            node->lon = e->ds.lon;
+            batch_tags(b, &b->node_tags, &b->n_node_tags, &b->cap_node_tags, e, cache);
+            break;
+
+        // Data set is way
+        case O5MREADER_DS_WAY:
+            if( packed_ways ) {
+                way = BATCH_ROW(b,ways);
+                way->id = e->ds.id;
+                if( b->n_str+WAYNODES_MAX_SIZE(e->ndCount) > b->cap_str )
+                    b->str = grow_array(b->str, &b->cap_str, b->n_str+WAYNODES_MAX_SIZE(e->ndCount), 1);
+                way->nodes = b->n_str;
+                way->len = waynodes_pack(e->nds, e->ndCount, (uint8_t *)b->str+b->n_str);
+                b->n_str += way->len;
+                batch_tags(b, &b->way_tags, &b->n_way_tags, &b->cap_way_tags, e, cache);
+                break;
+            }
+            if( b->n_way_nodes+e->ndCount > b->cap_way_nodes )
+                b->way_nodes = grow_array(b->way_nodes, &b->cap_way_nodes, b->n_way_nodes+e->ndCount, sizeof(WayNodeRow));
+            for( i=0; i<e->ndCount; i++ ) {
+                way_node = &b->way_nodes[b->n_way_nodes++];
+                way_node->way_id = e->ds.id;
+                way_node->node_id = e->nds[i];
+                way_node->local_order = i+1;
+            }
+            b->rows += e->ndCount;
+            batch_tags(b, &b->way_tags, &b->n_way_tags, &b->cap_way_tags, e, cache);
+            break;
+
+        // Data set is relation
+        case O5MREADER_DS_REL:
+            for( i=0; i<e->memberCount; i++ ) {
+                member = BATCH_ROW(b,rel_members);
+                member->relation_id = e->ds.id;
+                member->type = e->members[i].type;
+                member->ref = e->members[i].id;
+                member->role = dict_encoding ? dict_intern(&dict_roles, e->members[i].role) : batch_str(b,e->members[i].role);
+                member->local_order = i+1;
+            }
+            batch_tags(b, &b->rel_tags, &b->n_rel_tags, &b->cap_rel_tags, e, cache);
+            break;
+
+        default:
+            return;
+    }
+    batch_box(b, e);
+    b->types |= 1 << (e->ds.type-O5MREADER_DS_NODE);
+    b->counts[e->ds.type-O5MREADER_DS_NODE]++;
+    b->nds += e->ndCount;
+    b->datasets++;
+}
+
+static void step_stmt( sqlite3_stmt *stmt, const char *errmsg, int code ) {
+    if( sqlite3_step(stmt)==SQLITE_DONE ) sqlite3_reset(stmt);
+    else {
+        printf("%s", errmsg);
+        sqlite3_close(sqlite3_db_handle(stmt));
+        exit(code);
+    }
+}
+
+static const char *member_type( uint8_t type ) {
+    switch( type ) {
+        case O5MREADER_DS_NODE: return "node";
+        case O5MREADER_DS_WAY:  return "way";
+        case O5MREADER_DS_REL:  return "relation";
+        default:                return "";
+    }
+}
+
+/* member type in the --dict schema */
+static int member_code( uint8_t type ) {
+    switch( type ) {
+        case O5MREADER_DS_NODE: return 0;
+        case O5MREADER_DS_WAY:  return 1;
+        default:                return 2;
+    }
+}
+
+/* position of a member type in the order of the relation_members__type index */
+static int member_rank( uint8_t type ) {
+    if( dict_encoding ) return member_code(type);
+    switch( type ) {
+        case O5MREADER_DS_NODE: return 0;
+        case O5MREADER_DS_REL:  return 1;
+        default:                return 2;
+    }
+}
+
+/* bind row i of a batch table to the parameters starting at index col */
+typedef void (*BindRow)( sqlite3_stmt *stmt, int col, const Batch *b, size_t i );
+
+static void bind_node( sqlite3_stmt *stmt, int col, const Batch *b, size_t i ) {
+    sqlite3_bind_int64(stmt,col,b->nodes[i].id);
+    if( fixed_coords ) {
+        sqlite3_bind_int(stmt,col+1,b->nodes[i].lat);
+        sqlite3_bind_int(stmt,col+2,b->nodes[i].lon);
+    }
+    else {
+        sqlite3_bind_double(stmt,col+1,b->nodes[i].lat/1E7);
+        sqlite3_bind_double(stmt,col+2,b->nodes[i].lon/1E7);
+    }
+}
+
+static void bind_tag( sqlite3_stmt *stmt, int col, const Batch *b, const TagRow *tag ) {
+    sqlite3_bind_int64(stmt,col,tag->id);
+    if( dict_encoding ) {
+        sqlite3_bind_int64(stmt,col+1,tag->key);
+        sqlite3_bind_int64(stmt,col+2,tag->val);
+    }
+    else {
+        sqlite3_bind_text(stmt,col+1,b->str+tag->key,-1,NULL);
+        sqlite3_bind_text(stmt,col+2,b->str+tag->val,-1,NULL);
+    }
+}
+
+static void bind_node_tag( sqlite3_stmt *stmt, int col, const Batch *b, size_t i ) {
+    bind_tag(stmt, col, b, &b->node_tags[i]);
+}
+
+static void bind_way_tag( sqlite3_stmt *stmt, int col, const Batch *b, size_t i ) {
+    bind_tag(stmt, col, b, &b->way_tags[i]);
+}
+
+static void bind_rel_tag( sqlite3_stmt *stmt, int col, const Batch *b, size_t i ) {
+    bind_tag(stmt, col, b, &b->rel_tags[i]);
+}
+
+static void bind_way_node( sqlite3_stmt *stmt, int col, const Batch *b, size_t i ) {
+    sqlite3_bind_int64(stmt,col,b->way_nodes[i].way_id);
+    sqlite3_bind_int(stmt,col+1,b->way_nodes[i].local_order);
+    sqlite3_bind_int64(stmt,col+2,b->way_nodes[i].node_id);
+}
+
+static void bind_way( sqlite3_stmt *stmt, int col, const Batch *b, size_t i ) {
+    sqlite3_bind_int64(stmt,col,b->ways[i].id);
+    sqlite3_bind_blob(stmt,col+1,b->str+b->ways[i].nodes,b->ways[i].len,NULL);
+}
+
+static void bind_way_geometry( sqlite3_stmt *stmt, int col, const Batch *b, size_t i ) {
+    sqlite3_bind_int64(stmt,col,b->geoms[i].id);
+    sqlite3_bind_blob(stmt,col+1,b->str+b->geoms[i].geometry,b->geoms[i].len,NULL);
+}
+
+static void bind_rel_member( sqlite3_stmt *stmt, int col, const Batch *b, size_t i ) {
+    sqlite3_bind_int64(stmt,col,b->rel_members[i].relation_id);
+    if( dict_encoding ) sqlite3_bind_int(stmt,col+1,member_code(b->rel_members[i].type));
+    else sqlite3_bind_text(stmt,col+1,member_type(b->rel_members[i].type),-1,NULL);
+    sqlite3_bind_int64(stmt,col+2,b->rel_members[i].ref);
+    if( dict_encoding ) sqlite3_bind_int64(stmt,col+3,b->rel_members[i].role);
+    else sqlite3_bind_text(stmt,col+3,b->str+b->rel_members[i].role,-1,NULL);
+    sqlite3_bind_int(stmt,col+4,b->rel_members[i].local_order);
+}
+
+/*
+** External merge sort of variable length records. Each record is a 4 byte
+** payload length followed by the payload; records collect in 'data' until
+** the memory budget is used up, then they are sorted and spilled into a
+** temporary run file. The runs are merged with a binary heap.
+*/
+typedef int (*SortCmp)( const void *a, const void *b );    /* qsort style on char * payloads */
+
+typedef struct {
+    char *data;             size_t n_data, cap_data;
+    size_t n_recs;
+    FILE **runs;            size_t n_runs, cap_runs;
+    size_t budget;
+    SortCmp cmp;
+} Sorter;
+
+typedef struct {
+    FILE *f;
+    char *rec;
+    size_t cap;
+} RunReader;
+
+static Sorter *sorter_new( size_t budget, SortCmp cmp ) {
+    Sorter *s = calloc(1, sizeof(Sorter));
+    if( s==NULL ) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    s->budget = budget;
+    s->cmp = cmp;
+    return s;
+}
+
+static void sorter_free( Sorter *s ) {
+    size_t i;
+    for( i=0; i<s->n_runs; i++ ) fclose(s->runs[i]);
+    free(s->runs);
+    free(s->data);
+    free(s);
+}
+
+/*
+** Pointers to the payloads of all buffered records, sorted. The merge sort
+** is stable, records with equal keys stay in input order (the clustered
+** schema keeps the first of duplicate tag keys).
+*/
+static char **sorter_sort( Sorter *s ) {
+    char **recs = malloc((2*s->n_recs+1)*sizeof(char *));
+    char **from, **to, **t, *p = s->data;
+    size_t i, j, k, lo, mid, hi, width, n = s->n_recs;
+    uint32_t len;
+
+    if( recs==NULL ) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for( i=0; i<n; i++ ) {
+        memcpy(&len, p, 4);
+        recs[i] = p+4;
+        p += 4+len;
+    }
+    from = recs;
+    to = recs+n;
+    for( width=1; width<n; width*=2 ) {
+        for( lo=0; lo<n; lo+=2*width ) {
+            mid = lo+width<n ? lo+width : n;
+            hi = lo+2*width<n ? lo+2*width : n;
+            for( i=lo, j=mid, k=lo; k<hi; k++ )
+                to[k] = i<mid && (j>=hi || s->cmp(&from[i], &from[j])<=0) ? from[i++] : from[j++];
+        }
+        t = from; from = to; to = t;
+    }
+    if( from!=recs ) memcpy(recs, from, n*sizeof(char *));
+    return recs;
+}
+
+static void sorter_spill( Sorter *s ) {
+    char **recs;
+    FILE *f;
+    size_t i;
+    uint32_t len;
+
+    if( s->n_recs==0 ) return;
+    recs = sorter_sort(s);
+    f = tmpfile();
+    if( f==NULL ) {
+        fprintf(stderr, "can't create temporary sort file\n");
+        exit(1);
+    }
+    for( i=0; i<s->n_recs; i++ ) {
+        memcpy(&len, recs[i]-4, 4);
+        if( fwrite(recs[i]-4, 4+len, 1, f)!=1 ) {
+            fprintf(stderr, "can't write temporary sort file\n");
+            exit(1);
+        }
+    }
+    free(recs);
+    if( s->n_runs==s->cap_runs ) s->runs = grow_array(s->runs, &s->cap_runs, s->n_runs+1, sizeof(FILE *));
+    s->runs[s->n_runs++] = f;
+    s->n_data = s->n_recs = 0;
+}
+
+/* reserve a record of len bytes and return its payload */
+static char *sorter_record( Sorter *s, size_t len ) {
+    uint32_t len32 = len;
+    char *p;
+    if( s->n_data+4+len > s->cap_data ) s->data = grow_array(s->data, &s->cap_data, s->n_data+4+len, 1);
+    p = s->data+s->n_data;
+    memcpy(p, &len32, 4);
+    s->n_data += 4+len;
+    s->n_recs++;
+    return p+4;
+}
+
+static int run_next( RunReader *r ) {
+    uint32_t len;
+    if( fread(&len, 4, 1, r->f)!=1 ) return 0;
+    if( len>r->cap ) r->rec = grow_array(r->rec, &r->cap, len, 1);
+    if( len>0 && fread(r->rec, len, 1, r->f)!=1 ) {
+        fprintf(stderr, "can't read temporary sort file\n");
+        exit(1);
+    }
+    return 1;
+}
+
+typedef void (*SortVisit)( const char *rec, void *arg );
+
+/* order of the current records of runs a and b, equal ones in the order of the runs, which is input order */
+static int run_cmp( RunReader *runs, size_t a, size_t b, SortCmp cmp ) {
+    int c = cmp(&runs[a].rec, &runs[b].rec);
+    return c ? c : (a<b ? -1 : a>b);
+}
+
+static void heap_down( RunReader *runs, size_t *heap, size_t n, size_t i, SortCmp cmp ) {
+    size_t c, t;
+    for( ;; ) {
+        c = 2*i+1;
+        if( c>=n ) return;
+        if( c+1<n && run_cmp(runs, heap[c+1], heap[c], cmp)<0 ) c++;
+        if( run_cmp(runs, heap[c], heap[i], cmp)>=0 ) return;
+        t = heap[c]; heap[c] = heap[i]; heap[i] = t;
+        i = c;
+    }
+}
+
+/* call visit for every record in sorted order */
+static void sorter_merge( Sorter *s, SortVisit visit, void *arg ) {
+    RunReader *runs;
+    size_t *heap;
+    size_t i, n = 0;
+    char **recs;
+
+    if( s->n_runs==0 ) {
+        recs = sorter_sort(s);
+        for( i=0; i<s->n_recs; i++ ) visit(recs[i], arg);
+        free(recs);
+        return;
+    }
+    sorter_spill(s);
+    runs = calloc(s->n_runs, sizeof(RunReader));
+    heap = malloc(s->n_runs*sizeof(size_t));
+    if( runs==NULL || heap==NULL ) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for( i=0; i<s->n_runs; i++ ) {
+        runs[i].f = s->runs[i];
+        rewind(runs[i].f);
+        if( run_next(&runs[i]) ) heap[n++] = i;
+    }
+    for( i=n; i-->0; ) heap_down(runs, heap, n, i, s->cmp);
+    while( n>0 ) {
+        visit(runs[heap[0]].rec, arg);
+        if( !run_next(&runs[heap[0]]) ) heap[0] = heap[--n];
+        heap_down(runs, heap, n, 0, s->cmp);
+    }
+    for( i=0; i<s->n_runs; i++ ) free(runs[i].rec);
+    free(runs);
+    free(heap);
+}
+
+/*
+** Sort records of the tables. A tag record is id, key and value, a way node
+** record node_id, way_id, local_order and a member record type, ref,
+** relation_id, local_order and role; each sorts in the order of the index
+** named in its writer's sort_index. With --dict keys, values and roles are
+** 4 byte ids.
+*/
+typedef void (*SortEncode)( Sorter *s, const Batch *b, size_t i );
+typedef void (*SortDecode)( Batch *b, const char *rec );
+
+static int64_t rec_int64( const char *p ) {
+    int64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static int cmp_int64( int64_t a, int64_t b ) {
+    return a<b ? -1 : a>b;
+}
+
+static uint32_t rec_uint32( const char *p ) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static int cmp_uint32( uint32_t a, uint32_t b ) {
+    return a<b ? -1 : a>b;
+}
+
+static void encode_tag( Sorter *s, const Batch *b, const TagRow *tag ) {
+    const char *key = b->str+tag->key, *val = b->str+tag->val;
+    size_t lk, lv;
+    char *p;
+    if( dict_encoding ) {
+        p = sorter_record(s, 16);
+        memcpy(p, &tag->id, 8);
+        memcpy(p+8, &tag->key, 4);
+        memcpy(p+12, &tag->val, 4);
+        return;
+    }
+    lk = strlen(key)+1;
+    lv = strlen(val)+1;
+    p = sorter_record(s, 8+lk+lv);
+    memcpy(p, &tag->id, 8);
+    memcpy(p+8, key, lk);
+    memcpy(p+8+lk, val, lv);
+}
+
+static void encode_node_tag( Sorter *s, const Batch *b, size_t i ) { encode_tag(s, b, &b->node_tags[i]); }
+static void encode_way_tag( Sorter *s, const Batch *b, size_t i ) { encode_tag(s, b, &b->way_tags[i]); }
+static void encode_rel_tag( Sorter *s, const Batch *b, size_t i ) { encode_tag(s, b, &b->rel_tags[i]); }
+
+static void decode_tag( Batch *b, TagRow *tag, const char *rec ) {
+    tag->id = rec_int64(rec);
+    if( dict_encoding ) {
+        tag->key = rec_uint32(rec+8);
+        tag->val = rec_uint32(rec+12);
+        return;
+    }
+    tag->key = batch_str(b, rec+8);
+    tag->val = batch_str(b, rec+8+strlen(rec+8)+1);
+}
+
+static void decode_node_tag( Batch *b, const char *rec ) { decode_tag(b, BATCH_ROW(b,node_tags), rec); }
+static void decode_way_tag( Batch *b, const char *rec ) { decode_tag(b, BATCH_ROW(b,way_tags), rec); }
+static void decode_rel_tag( Batch *b, const char *rec ) { decode_tag(b, BATCH_ROW(b,rel_tags), rec); }
+
+static int cmp_tag_key( const char *ra, const char *rb ) {
+    return dict_encoding ? cmp_uint32(rec_uint32(ra+8), rec_uint32(rb+8)) : strcmp(ra+8, rb+8);
+}
+
+static int cmp_tag( const void *a, const void *b ) {
+    const char *ra = *(const char **)a, *rb = *(const char **)b;
+    int c = cmp_tag_key(ra, rb);
+    return c ? c : cmp_int64(rec_int64(ra), rec_int64(rb));
+}
+
+static void encode_way_node( Sorter *s, const Batch *b, size_t i ) {
+    char *p = sorter_record(s, 20);
+    memcpy(p, &b->way_nodes[i].node_id, 8);
+    memcpy(p+8, &b->way_nodes[i].way_id, 8);
+    memcpy(p+16, &b->way_nodes[i].local_order, 4);
+}
+
+static void decode_way_node( Batch *b, const char *rec ) {
+    WayNodeRow *way_node = BATCH_ROW(b,way_nodes);
+    way_node->node_id = rec_int64(rec);
+    way_node->way_id = rec_int64(rec+8);
+    memcpy(&way_node->local_order, rec+16, 4);
+}
+
+static int cmp_way_node( const void *a, const void *b ) {
+    const char *ra = *(const char **)a, *rb = *(const char **)b;
+    int c = cmp_int64(rec_int64(ra), rec_int64(rb));
+    return c ? c : cmp_int64(rec_int64(ra+8), rec_int64(rb+8));
+}
+
+static void encode_rel_member( Sorter *s, const Batch *b, size_t i ) {
+    const MemberRow *m = &b->rel_members[i];
+    const char *role = dict_encoding ? (const char *)&m->role : b->str+m->role;
+    size_t lr = dict_encoding ? 4 : strlen(role)+1;
+    char *p = sorter_record(s, 21+lr);
+    p[0] = m->type;
+    memcpy(p+1, &m->ref, 8);
+    memcpy(p+9, &m->relation_id, 8);
+    memcpy(p+17, &m->local_order, 4);
+    memcpy(p+21, role, lr);
+}
+
+static void decode_rel_member( Batch *b, const char *rec ) {
+    MemberRow *m = BATCH_ROW(b,rel_members);
+    m->type = rec[0];
+    m->ref = rec_int64(rec+1);
+    m->relation_id = rec_int64(rec+9);
+    memcpy(&m->local_order, rec+17, 4);
+    m->role = dict_encoding ? rec_uint32(rec+21) : batch_str(b, rec+21);
+}
+
+static int cmp_rel_member( const void *a, const void *b ) {
+    const char *ra = *(const char **)a, *rb = *(const char **)b;
+    int c = member_rank(ra[0]) - member_rank(rb[0]);
+    if( c==0 ) c = cmp_int64(rec_int64(ra+1), rec_int64(rb+1));
+    return c ? c : cmp_int64(rec_int64(ra+9), rec_int64(rb+9));
+}
+
+/* primary key orders of the clustered schema */
+static int cmp_tag_clustered( const void *a, const void *b ) {
+    const char *ra = *(const char **)a, *rb = *(const char **)b;
+    int c = cmp_int64(rec_int64(ra), rec_int64(rb));
+    return c ? c : cmp_tag_key(ra, rb);
+}
+
+static int cmp_way_node_clustered( const void *a, const void *b ) {
+    const char *ra = *(const char **)a, *rb = *(const char **)b;
+    uint32_t la, lb;
+    int c = cmp_int64(rec_int64(ra+8), rec_int64(rb+8));
+    memcpy(&la, ra+16, 4);
+    memcpy(&lb, rb+16, 4);
+    return c ? c : (la<lb ? -1 : la>lb);
+}
+
+static int cmp_rel_member_clustered( const void *a, const void *b ) {
+    const char *ra = *(const char **)a, *rb = *(const char **)b;
+    uint32_t la, lb;
+    int c = cmp_int64(rec_int64(ra+9), rec_int64(rb+9));
+    memcpy(&la, ra+17, 4);
+    memcpy(&lb, rb+17, 4);
+    return c ? c : (la<lb ? -1 : la>lb);
+}
+
+/*
+** One writer per target table. Rows go in groups of 'multi_rows' through a
+** multi-row INSERT ... VALUES (...),(...) statement, the leftovers of a batch
+** through the single-row statement.
+*/
+typedef struct {
+    const char *name;
+    const char *insert;     /* INSERT statement up to VALUES */
+    int n_cols;
+    BindRow bind;
+    const char *errmsg;
+    int code;
+    sqlite3_stmt *single, *multi;
+    int multi_rows;
+    uint64_t rows;          /* rows inserted */
+    double seconds;         /* time spent inserting */
+    const char *sort_index; /* sorted load: index filled in key order */
+    SortEncode encode;
+    SortDecode decode;
+    SortCmp cmp;
+    SortCmp cmp_clustered;  /* sort order for the clustered schema */
+    Sorter *sorter;
+    int ignore;             /* INSERT OR IGNORE, rows with a duplicate primary key are dropped */
+    uint64_t dropped;       /* rows dropped that way */
+} TableWriter;
+
+enum { W_NODES, W_NODE_TAGS, W_WAY_NODES, W_WAY_TAGS, W_WAY_GEOMETRY, W_REL_MEMBERS, W_REL_TAGS, W_COUNT };
+
+/* name and insert are set by schema_build(), a writer without insert has no table */
+TableWriter writers[W_COUNT] = {
+    { "nodes",            NULL, 3, bind_node,       "could not insert node.\n",       -6 },
+    { "node_tags",        NULL, 3, bind_node_tag,   "could not insert node tag.\n",   -7,
+        NULL, NULL, 0, 0, 0, NULL, encode_node_tag, decode_node_tag, cmp_tag, cmp_tag_clustered },
+    { "way_nodes",        NULL, 3, bind_way_node,   "could not insert way node.\n",   -9,
+        NULL, NULL, 0, 0, 0, NULL, encode_way_node, decode_way_node, cmp_way_node, cmp_way_node_clustered },
+    { "way_tags",         NULL, 3, bind_way_tag,    "could not insert way tag.\n",    -10,
+        NULL, NULL, 0, 0, 0, NULL, encode_way_tag, decode_way_tag, cmp_tag, cmp_tag_clustered },
+    { "way_geometry",     NULL, 2, bind_way_geometry, "could not insert way geometry.\n", -17 },
+    { "relation_members", NULL, 5, bind_rel_member, "could not insert rel member.\n", -12,
+        NULL, NULL, 0, 0, 0, NULL, encode_rel_member, decode_rel_member, cmp_rel_member, cmp_rel_member_clustered },
+    { "relation_tags",    NULL, 3, bind_rel_tag,    "could not insert rel tag.\n",    -13,
+        NULL, NULL, 0, 0, 0, NULL, encode_rel_tag, decode_rel_tag, cmp_tag, cmp_tag_clustered },
+};
+#define N_SORTED_TABLES 5
+
+/* append formatted SQL to an sqlite3_mprintf string */
+static char *sql_append( char *sql, const char *fmt, ... ) {
+    va_list ap;
+    char *piece;
+    va_start(ap, fmt);
+    piece = sqlite3_vmprintf(fmt, ap);
+    va_end(ap);
+    return sqlite3_mprintf("%z%z", sql, piece);
+}
+
+static void schema_tags( int shard, TableWriter *w, const char *table, const char *dict_table, const char *id ) {
+    const char *name = dict_encoding ? dict_table : table;
+    const char *key = dict_encoding ? "key_id" : "key";
+    char *index;
+
+    schema.tables[shard] = sql_append(schema.tables[shard], "CREATE TABLE %s (%s INTEGER,%s%z)%s;\n",
+        name, id, dict_encoding ? "key_id INTEGER,value_id INTEGER" : "key TEXT,value TEXT",
+        clustered ? sqlite3_mprintf(",PRIMARY KEY (%s,%s)", id, key) : NULL, clustered ? " WITHOUT ROWID" : "");
+    if( !clustered )
+        schema.indexes[shard] = sql_append(schema.indexes[shard], "CREATE INDEX %s__%s ON %s ( %s );\n", table, id, name, id);
+    index = sqlite3_mprintf("CREATE INDEX %s__key ON %s ( %s );\n", table, name, key);
+    schema.indexes[shard] = sql_append(schema.indexes[shard], "%s", index);
+    // the clustered tables are loaded in primary key order, without a sort index
+    if( clustered ) sqlite3_free(index);
+    else w->sort_index = index;
+    if( dict_encoding )
+        schema.dict_tables = sql_append(schema.dict_tables,
+            "CREATE VIEW %s AS SELECT %s,key,value FROM %s JOIN keys USING (key_id) JOIN tag_values USING (value_id);\n",
+            table, id, name);
+    // the first of duplicate keys of an object wins, the others are counted, see print_dropped()
+    w->name = name;
+    w->ignore = clustered;
+    w->insert = sqlite3_mprintf("INSERT%s INTO %s (%s,%s,%s) VALUES ", clustered ? " OR IGNORE" : "",
+        name, id, key, dict_encoding ? "value_id" : "value");
+}
+
+static const uint8_t entity_types[3] = { O5MREADER_DS_NODE, O5MREADER_DS_WAY, O5MREADER_DS_REL };
+
+/*
+** Split a [node:|way:|relation:]key[=value] spec in place. *typed is the
+** index of the type in entity_types or -1 if there is none, *value is NULL
+** without '='. Returns 0 if the key or value is empty.
+*/
+static int parse_tag_spec( char *spec, int *typed, char **key, char **value ) {
+    const char *p;
+    int i;
+
+    *typed = -1;
+    *key = spec;
+    for( i=0; i<3; i++ ) {
+        p = member_type(entity_types[i]);
+        if( strncmp(spec,p,strlen(p))==0 && spec[strlen(p)]==':' ) {
+            *typed = i;
+            *key = spec+strlen(p)+1;
+        }
+    }
+    *value = strchr(*key, '=');
+    if( *value ) *(*value)++ = 0;
+    return **key!=0 && (*value==NULL || **value!=0);
+}
+
+static char *strdup_or_exit( const char *s ) {
+    char *copy = strdup(s);
+    if( copy==NULL ) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return copy;
+}
+
+/*
+** Add the indexes of a --rtree list, [node:|way:|relation:]key[=value],...
+** A spec without type adds an index for each type, the key * indexes all
+** entities of the type. Returns 0 on a bad list.
+*/
+static int rtree_parse( const char *list ) {
+    const uint8_t *types = entity_types;
+    char *copy = strdup_or_exit(list);
+    char *spec, *key, *value, *p, *save = NULL;
+    RtreeIndex *r;
+    int i, j, typed;
+
+    for( spec=strtok_r(copy,",",&save); spec; spec=strtok_r(NULL,",",&save) ) {
+        if( !parse_tag_spec(spec, &typed, &key, &value) || (strcmp(key,"*")==0 && value) ) {
+            free(copy);
+            return 0;
+        }
+        for( i=0; i<3; i++ ) {
+            if( typed>=0 && i!=typed ) continue;
+            // the join at the end only covers tagged ways
+            if( types[i]==O5MREADER_DS_WAY && locations.mode==LOC_NONE && strcmp(key,"*")==0 ) {
+                if( typed<0 ) continue;
+                fprintf(stderr, "--rtree=way:* needs a node location store, not --locations=none\n");
+                exit(1);
+            }
+            // relation boxes are made of the members' boxes while decoding
+            if( types[i]==O5MREADER_DS_REL && locations.mode==LOC_NONE ) {
+                if( typed<0 ) continue;
+                fprintf(stderr, "relation R*Trees need a node location store, not --locations=none\n");
+                exit(1);
+            }
+            if( n_rtrees==MAX_RTREES ) {
+                fprintf(stderr, "at most %d R*Tree indexes\n", MAX_RTREES);
+                exit(1);
+            }
+            r = &rtrees[n_rtrees];
+            r->type = types[i];
+            r->key = strdup_or_exit(key);
+            r->value = value ? strdup_or_exit(value) : NULL;
+            if( strcmp(key,"*")==0 ) r->table = sqlite3_mprintf("rtree_%s", member_type(types[i]));
+            else r->table = value ? sqlite3_mprintf("rtree_%s_%s_%s", member_type(types[i]), key, value) :
+                sqlite3_mprintf("rtree_%s_%s", member_type(types[i]), key);
+            for( p=r->table; *p; p++ ) if( !isalnum((unsigned char)*p) ) *p = '_';
+            r->joined = types[i]==O5MREADER_DS_WAY && locations.mode==LOC_NONE;
+            for( j=0; j<n_rtrees && strcmp(rtrees[j].table,r->table)!=0; j++ );
+            if( j==n_rtrees ) n_rtrees++;
+        }
+    }
+    free(copy);
+    return 1;
+}
+
+/*
+** Set of non-negative ids as a bitmap in chunks of 64K ids, a chunk is
+** allocated when the first id in its range is added.
+*/
+#define IDSET_CHUNK_BITS 16
+
+typedef struct {
+    uint64_t **chunks;      size_t n_chunks;
+    uint64_t count;         /* ids added */
+    size_t bytes;
+} IdSet;
+
+static void idset_add( IdSet *s, int64_t id ) {
+    size_t c = (uint64_t)id >> IDSET_CHUNK_BITS, n;
+    uint64_t *bits, bit = 1ULL << (id & 63);
+
+    if( id<0 ) return;
+    if( c>=s->n_chunks ) {
+        n = s->n_chunks ? s->n_chunks : 256;
+        while( n<=c ) n *= 2;
+        s->chunks = realloc(s->chunks, n*sizeof(uint64_t *));
+        if( s->chunks==NULL ) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        memset(s->chunks+s->n_chunks, 0, (n-s->n_chunks)*sizeof(uint64_t *));
+        s->n_chunks = n;
+    }
+    if( s->chunks[c]==NULL ) {
+        s->chunks[c] = calloc(1, 1<<(IDSET_CHUNK_BITS-3));
+        if( s->chunks[c]==NULL ) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        s->bytes += 1<<(IDSET_CHUNK_BITS-3);
+    }
+    bits = &s->chunks[c][(id & ((1<<IDSET_CHUNK_BITS)-1)) >> 6];
+    if( !(*bits & bit) ) s->count++;
+    *bits |= bit;
+}
+
+static int idset_has( const IdSet *s, int64_t id ) {
+    size_t c = (uint64_t)id >> IDSET_CHUNK_BITS;
+    if( id<0 || c>=s->n_chunks || s->chunks[c]==NULL ) return 0;
+    return (s->chunks[c][(id & ((1<<IDSET_CHUNK_BITS)-1)) >> 6] >> (id & 63)) & 1;
+}
+
+static void idset_free( IdSet *s ) {
+    size_t c;
+    for( c=0; c<s->n_chunks; c++ ) free(s->chunks[c]);
+    free(s->chunks);
+    memset(s, 0, sizeof(IdSet));
+}
+
+/*
+** Import filters, evaluated by the decoders through o5mreader_setFilter().
+** --types and the area test of nodes are decided on the dataset header, so
+** rejected entities are never decoded into an entity. --keep needs the tags
+** and ways and relations in the area need their node refs and members.
+** Ways are in the area if one of their nodes is, relations if one of their
+** member nodes or ways is; both need the decoder to see the nodes first.
+*/
+typedef struct { char *key, *value; uint8_t types; } TagMatch;
+
+#define MAX_KEEPS 64
+TagMatch keeps[MAX_KEEPS];
+int n_keeps = 0;
+uint8_t keep_types = 0;     /* bit 0/1/2: nodes/ways/relations have --keep entries */
+uint8_t import_types = 7;   /* bit 0/1/2: import nodes/ways/relations */
+
+/* --bbox or --polygon, rings of lat, lon pairs in 1E-7 degrees */
+typedef struct { int32_t *pts; size_t n, cap; int hole; } Ring;
+
+int area_filter = 0;
+int32_t area_min_lat, area_max_lat, area_min_lon, area_max_lon;
+Ring *rings;                size_t n_rings, cap_rings;
+IdSet area_nodes, area_ways;
+
+/*
+** --nodes=referenced: a first pass over the ways and relations marks the
+** nodes they refer to, the import then skips untagged nodes not marked.
+*/
+int referenced_nodes = 0;
+IdSet node_refs;
+double referenced_seconds;
+
+int filtering = 0;          /* any filter is set */
+
+/* entities per type seen by a decoder and passed by its filter */
+typedef struct { uint64_t seen[3], passed[3], unreferenced; } FilterStats;
+
+FilterStats filter_totals;
+
+/* add the entries of a --keep list, returns 0 on a bad list */
+static int keep_parse( const char *list ) {
+    char *copy = strdup_or_exit(list);
+    char *spec, *key, *value, *save = NULL;
+    TagMatch *m;
+    int typed;
+
+    for( spec=strtok_r(copy,",",&save); spec; spec=strtok_r(NULL,",",&save) ) {
+        if( !parse_tag_spec(spec, &typed, &key, &value) || n_keeps==MAX_KEEPS ) {
+            free(copy);
+            return 0;
+        }
+        m = &keeps[n_keeps++];
+        m->key = strdup_or_exit(key);
+        m->value = value ? strdup_or_exit(value) : NULL;
+        m->types = typed<0 ? 7 : 1<<typed;
+        keep_types |= m->types;
+    }
+    free(copy);
+    return 1;
+}
+
+/* --types=node,way,relation */
+static int types_parse( const char *list ) {
+    char *copy = strdup_or_exit(list);
+    char *type, *save = NULL;
+    int i;
+
+    import_types = 0;
+    for( type=strtok_r(copy,",",&save); type; type=strtok_r(NULL,",",&save) ) {
+        for( i=0; i<3 && strcmp(type,member_type(entity_types[i]))!=0; i++ );
+        if( i==3 ) {
+            free(copy);
+            return 0;
+        }
+        import_types |= 1<<i;
+    }
+    free(copy);
+    return import_types!=0;
+}
+
+/* --bbox=min_lon,min_lat,max_lon,max_lat in degrees */
+static int bbox_parse( const char *arg ) {
+    double v[4];
+    if( sscanf(arg, "%lf,%lf,%lf,%lf", &v[0], &v[1], &v[2], &v[3])!=4 || v[0]>v[2] || v[1]>v[3] ) return 0;
+    area_min_lon = (int32_t)(v[0]*1E7);
+    area_min_lat = (int32_t)(v[1]*1E7);
+    area_max_lon = (int32_t)(v[2]*1E7);
+    area_max_lat = (int32_t)(v[3]*1E7);
+    area_filter = 1;
+    return 1;
+}
+
+/*
+** --polygon: an osmosis .poly file, a name line followed by sections of
+** "lon lat" lines ending in END, sections named !... are holes. The area
+** is the union of the outer rings without the holes.
+*/
+static int polygon_parse( const char *path ) {
+    FILE *f = fopen(path, "r");
+    char line[256], name[256];
+    double lon, lat;
+    Ring *r = NULL;
+    size_t i;
+    int first = 1;
+
+    if( f==NULL || fgets(line,sizeof(line),f)==NULL ) {
+        if( f ) fclose(f);
+        return 0;
+    }
+    while( fgets(line,sizeof(line),f) ) {
+        if( sscanf(line, " %255s", name)!=1 ) continue;
+        if( r==NULL ) {
+            if( strcmp(name,"END")==0 ) break;
+            if( n_rings==cap_rings ) rings = grow_array(rings, &cap_rings, n_rings+1, sizeof(Ring));
+            r = &rings[n_rings++];
+            memset(r, 0, sizeof(Ring));
+            r->hole = name[0]=='!';
+            continue;
+        }
+        if( strcmp(name,"END")==0 ) {
+            if( r->n<3 ) break;
+            r = NULL;
+            continue;
+        }
+        if( sscanf(line, "%lf %lf", &lon, &lat)!=2 ) break;
+        if( r->n*2+2 > r->cap ) r->pts = grow_array(r->pts, &r->cap, r->n*2+2, sizeof(int32_t));
+        r->pts[r->n*2] = (int32_t)(lat*1E7);
+        r->pts[r->n*2+1] = (int32_t)(lon*1E7);
+        r->n++;
+    }
+    fclose(f);
+    if( r!=NULL ) return 0;
+    // the bounding box of the outer rings rejects most nodes without a ring test
+    for( r=rings; r<rings+n_rings; r++ ) {
+        for( i=0; i<r->n && !r->hole; i++ ) {
+            if( first || r->pts[2*i]<area_min_lat ) area_min_lat = r->pts[2*i];
+            if( first || r->pts[2*i]>area_max_lat ) area_max_lat = r->pts[2*i];
+            if( first || r->pts[2*i+1]<area_min_lon ) area_min_lon = r->pts[2*i+1];
+            if( first || r->pts[2*i+1]>area_max_lon ) area_max_lon = r->pts[2*i+1];
+            first = 0;
+        }
+    }
+    if( first ) return 0;
+    area_filter = 1;
+    return 1;
+}
+
+/* crossing number test */
+static int ring_contains( const Ring *r, int32_t lat, int32_t lon ) {
+    size_t i, j;
+    int in = 0;
+    for( i=0, j=r->n-1; i<r->n; j=i++ ) {
+        int64_t lat_i = r->pts[2*i], lat_j = r->pts[2*j], lon_i = r->pts[2*i+1], lon_j = r->pts[2*j+1];
+        if( (lat_i>lat)!=(lat_j>lat) && lon < lon_i + (double)(lon_j-lon_i)*(lat-lat_i)/(lat_j-lat_i) ) in = !in;
+    }
+    return in;
+}
+
+static int area_contains( int32_t lat, int32_t lon ) {
+    size_t i;
+    int in = 0;
+    if( lat<area_min_lat || lat>area_max_lat || lon<area_min_lon || lon>area_max_lon ) return 0;
+    if( n_rings==0 ) return 1;
+    for( i=0; i<n_rings; i++ ) {
+        if( rings[i].hole ) {
+            if( ring_contains(&rings[i], lat, lon) ) return 0;
+        }
+        else if( !in ) in = ring_contains(&rings[i], lat, lon);
+    }
+    return in;
+}
+
+static int keep_match( const O5mreaderEntity *e, uint8_t type_bit ) {
+    size_t i;
+    int k;
+    for( k=0; k<n_keeps; k++ ) {
+        if( !(keeps[k].types & type_bit) ) continue;
+        for( i=0; i<e->tagCount; i++ )
+            if( strcmp(e->tags[i].key,keeps[k].key)==0 && (keeps[k].value==NULL || strcmp(e->tags[i].val,keeps[k].value)==0) )
+                return 1;
+    }
+    return 0;
+}
+
+/* O5mreaderFilter of the import filters, arg is the decoder's FilterStats */
+static int filter_entity( const O5mreaderEntity *e, int complete, void *arg ) {
+    FilterStats *stats = arg;
+    int t = e->ds.type-O5MREADER_DS_NODE;
+    size_t i;
+    int in;
+
+    if( t<0 || t>2 ) return 1;
+    if( !complete ) {
+        stats->seen[t]++;
+        if( !(import_types & 1<<t) ) return 0;
+        if( t==0 && area_filter ) {
+            if( area_contains(e->ds.lat, e->ds.lon) ) idset_add(&area_nodes, e->ds.id);
+            else if( !referenced_nodes || !idset_has(&node_refs, e->ds.id) ) return 0;
+        }
+        return 1;
+    }
+    // nodes of imported ways and relations are imported whatever their tags
+    if( t==0 && referenced_nodes ) {
+        if( idset_has(&node_refs, e->ds.id) ) {
+            stats->passed[t]++;
+            return 1;
+        }
+        if( e->tagCount==0 ) {
+            stats->unreferenced++;
+            return 0;
+        }
+        if( area_filter && !idset_has(&area_nodes, e->ds.id) ) return 0;
+    }
+    if( t==1 && area_filter ) {
+        for( i=0; i<e->ndCount && !idset_has(&area_nodes, e->nds[i]); i++ );
+        if( i==e->ndCount ) return 0;
+        idset_add(&area_ways, e->ds.id);
+    }
+    if( t==2 && area_filter ) {
+        for( i=0, in=0; i<e->memberCount && !in; i++ ) {
+            if( e->members[i].type==O5MREADER_DS_NODE ) in = idset_has(&area_nodes, e->members[i].id);
+            else if( e->members[i].type==O5MREADER_DS_WAY ) in = idset_has(&area_ways, e->members[i].id);
+        }
+        if( !in ) return 0;
+    }
+    if( (keep_types & 1<<t) && !keep_match(e, 1<<t) ) return 0;
+    stats->passed[t]++;
+    return 1;
+}
+
+static void filter_stats_add( const FilterStats *stats ) {
+    int t;
+    for( t=0; t<3; t++ ) {
+        filter_totals.seen[t] += stats->seen[t];
+        filter_totals.passed[t] += stats->passed[t];
+    }
+    filter_totals.unreferenced += stats->unreferenced;
+}
+
+static void print_filter_stats( void ) {
+    int t;
+    if( !filtering ) return;
+    fprintf(stderr, "\nfilter:");
+    for( t=0; t<3; t++ )
+        fprintf(stderr, "%s %llu of %llu %ss", t ? "," : "", (unsigned long long)filter_totals.passed[t],
+            (unsigned long long)filter_totals.seen[t], member_type(entity_types[t]));
+    fprintf(stderr, "\n");
+    if( area_filter )
+        fprintf(stderr, "area: %llu nodes, %llu ways, %.1f MB of id bitmaps\n", (unsigned long long)area_nodes.count,
+            (unsigned long long)area_ways.count, (area_nodes.bytes+area_ways.bytes)/1048576.0);
+    if( referenced_nodes )
+        fprintf(stderr, "referenced nodes: %llu in a %.1f MB bitmap marked in %.2fs, %llu untagged nodes skipped\n",
+            (unsigned long long)node_refs.count, node_refs.bytes/1048576.0, referenced_seconds,
+            (unsigned long long)filter_totals.unreferenced);
+    idset_free(&area_nodes);
+    idset_free(&area_ways);
+    idset_free(&node_refs);
+}
+
+/* first pass of --nodes=referenced: nodes are only decoded for an area filter */
+static int filter_referencing( const O5mreaderEntity *e, int complete, void *arg ) {
+    if( e->ds.type!=O5MREADER_DS_NODE ) return filter_entity(e, complete, arg);
+    if( area_filter && !complete && area_contains(e->ds.lat, e->ds.lon) ) idset_add(&area_nodes, e->ds.id);
+    return 0;
+}
+
+/*
+** Offset of the first reset whose chunk doesn't start with a node, the
+** first pass starts there. Files written by osmconvert have a reset in
+** front of the ways, others are read from the start with their nodes
+** skipped. Area filters need the nodes, they always start at 0.
+*/
+static uint64_t referencing_start( FILE *f ) {
+    O5mreader *reader;
+    O5mreaderDataset ds;
+    uint64_t *offsets, start = 0;
+    size_t i, n;
+
+    if( area_filter || o5mreader_scanResets(f, 0, &offsets, &n)==O5MREADER_RET_ERR ) return 0;
+    for( i=0; i+1<n; i++ ) {
+        if( o5mreader_openRange(&reader, f, offsets[i], offsets[i+1])==O5MREADER_RET_ERR ) break;
+        if( o5mreader_iterateDataSet(reader, &ds)==O5MREADER_ITERATE_RET_NEXT && ds.type!=O5MREADER_DS_NODE ) {
+            o5mreader_close(reader);
+            start = offsets[i];
+            break;
+        }
+        o5mreader_close(reader);
+    }
+    free(offsets);
+    return start;
+}
+
+/* --nodes=referenced: mark the nodes of the ways and relations that pass the filters */
+static void mark_referenced( FILE *f ) {
+    O5mreader *reader;
+    O5mreaderEntity *e;
+    O5mreaderIterateRet ret;
+    FilterStats stats;
+    double t = now();
+    uint64_t start = referencing_start(f);
+    size_t i;
+
+    memset(&stats, 0, sizeof(stats));
+    if( o5mreader_openRange(&reader, f, start, 0)==O5MREADER_RET_ERR ) {
+        fprintf(stderr, "can't read o5m file\n");
+        exit(1);
+    }
+    o5mreader_setFilter(reader, filter_referencing, &stats);
+    while( (ret = o5mreader_readEntity(reader, &e))==O5MREADER_ITERATE_RET_NEXT ) {
+        if( e->ds.type==O5MREADER_DS_WAY )
+            for( i=0; i<e->ndCount; i++ ) idset_add(&node_refs, e->nds[i]);
+        else if( e->ds.type==O5MREADER_DS_REL )
+            for( i=0; i<e->memberCount; i++ )
+                if( e->members[i].type==O5MREADER_DS_NODE ) idset_add(&node_refs, e->members[i].id);
+    }
+    if( ret==O5MREADER_ITERATE_RET_ERR ) {
+        fprintf(stderr, "o5m read error: %s\n", o5mreader_strerror(reader->errCode));
+        exit(1);
+    }
+    o5mreader_close(reader);
+    rewind(f);
+    referenced_seconds = now()-t;
+}
+
+/* assemble the tables, indexes and insert statements of the layout options */
+static void schema_build( void ) {
+    TableWriter *w;
+    const char *name;
+    char *cond, *index;
+    int i;
+
+    for( i=0; i<3; i++ ) schema.tables[i] = schema.indexes[i] = NULL;
+    schema.dict_tables = schema.dict_indexes = NULL;
+    if( dict_encoding ) {
+        schema.dict_tables = sqlite3_mprintf("%s",
+            "CREATE TABLE keys (key_id INTEGER PRIMARY KEY,key TEXT);\n"
+            "CREATE TABLE tag_values (value_id INTEGER PRIMARY KEY,value TEXT);\n"
+            "CREATE TABLE roles (role_id INTEGER PRIMARY KEY,role TEXT);\n");
+        schema.dict_indexes = sqlite3_mprintf("%s",
+            "CREATE UNIQUE INDEX keys__key ON keys ( key );\n"
+            "CREATE INDEX tag_values__value ON tag_values ( value );\n"
+            "CREATE UNIQUE INDEX roles__role ON roles ( role );\n");
+    }
+
+    // nodes
+    w = &writers[W_NODES];
+    if( fixed_coords ) {
+        schema.tables[0] = sql_append(schema.tables[0], "%s",
+            "CREATE TABLE nodes_fixed (node_id INTEGER PRIMARY KEY,lat INTEGER,lon INTEGER);\n"
+            "CREATE VIEW nodes AS SELECT node_id,lat/1E7 AS lat,lon/1E7 AS lon FROM nodes_fixed;\n");
+        w->name = "nodes_fixed";
+        w->insert = "INSERT INTO nodes_fixed (node_id,lat,lon) VALUES ";
+    }
+    else {
+        schema.tables[0] = sql_append(schema.tables[0], "CREATE TABLE nodes (node_id INTEGER PRIMARY KEY,lat REAL,lon REAL);\n");
+        w->insert = "INSERT INTO nodes (node_id,lat,lon) VALUES ";
+    }
+    schema_tags(0, &writers[W_NODE_TAGS], "node_tags", "node_tags_dict", "node_id");
+
+    // ways
+    schema_tags(1, &writers[W_WAY_TAGS], "way_tags", "way_tags_dict", "way_id");
+    w = &writers[W_WAY_NODES];
+    if( packed_ways ) {
+        // the node lists are written as is, the view decodes them
+        schema.tables[1] = sql_append(schema.tables[1], "%s",
+            "CREATE TABLE ways (way_id INTEGER PRIMARY KEY,nodes BLOB);\n"
+            "CREATE VIEW way_nodes AS SELECT way_id,local_order,node_id FROM ways,way_nodes_unpack(ways.nodes);\n");
+        w->name = "ways";
+        w->insert = "INSERT INTO ways (way_id,nodes) VALUES ";
+        w->n_cols = 2;
+        w->bind = bind_way;
+        w->errmsg = "could not insert way.\n";
+        w->encode = NULL;
+    }
+    else {
+        schema.tables[1] = sql_append(schema.tables[1], "CREATE TABLE way_nodes (way_id INTEGER,local_order INTEGER,node_id INTEGER%s)%s;\n",
+            clustered ? ",PRIMARY KEY (way_id,local_order)" : "", clustered ? " WITHOUT ROWID" : "");
+        if( !clustered )
+            schema.indexes[1] = sql_append(schema.indexes[1], "CREATE INDEX way_nodes__way_id ON way_nodes ( way_id );\n");
+        w->sort_index = "CREATE INDEX way_nodes__node_id ON way_nodes ( node_id );\n";
+        schema.indexes[1] = sql_append(schema.indexes[1], "%s", w->sort_index);
+        w->insert = "INSERT INTO way_nodes (way_id,local_order,node_id) VALUES ";
+    }
+
+    if( way_geometry ) {
+        schema.tables[1] = sql_append(schema.tables[1], "CREATE TABLE way_geometry (way_id INTEGER PRIMARY KEY,geometry BLOB);\n");
+        writers[W_WAY_GEOMETRY].insert = "INSERT INTO way_geometry (way_id,geometry) VALUES ";
+        store_locations = 1;
+    }
+
+    // relations
+    schema_tags(2, &writers[W_REL_TAGS], "relation_tags", "relation_tags_dict", "relation_id");
+    w = &writers[W_REL_MEMBERS];
+    name = dict_encoding ? "relation_members_dict" : "relation_members";
+    schema.tables[2] = sql_append(schema.tables[2], "CREATE TABLE %s (relation_id INTEGER,type %s,ref INTEGER,%s,local_order INTEGER%s)%s;\n",
+        name, dict_encoding ? "INTEGER" : "TEXT", dict_encoding ? "role_id INTEGER" : "role TEXT",
+        clustered ? ",PRIMARY KEY (relation_id,local_order)" : "", clustered ? " WITHOUT ROWID" : "");
+    if( !clustered )
+        schema.indexes[2] = sql_append(schema.indexes[2], "CREATE INDEX relation_members__relation_id ON %s ( relation_id );\n", name);
+    index = sqlite3_mprintf("CREATE INDEX relation_members__type ON %s ( type, ref );\n", name);
+    schema.indexes[2] = sql_append(schema.indexes[2], "%s", index);
+    if( clustered ) sqlite3_free(index);
+    else w->sort_index = index;
+    if( dict_encoding )
+        schema.dict_tables = sql_append(schema.dict_tables,
+            "CREATE VIEW relation_members AS SELECT relation_id,"
+            "CASE type WHEN 0 THEN 'node' WHEN 1 THEN 'way' ELSE 'relation' END AS type,ref,role,local_order "
+            "FROM relation_members_dict JOIN roles USING (role_id);\n");
+    w->name = name;
+    w->insert = sqlite3_mprintf("INSERT INTO %s (relation_id,type,ref,%s,local_order) VALUES ",
+        name, dict_encoding ? "role_id" : "role");
+
+    schema.finish = NULL;
+    if( node_ways )
+        schema.finish = sql_append(schema.finish, "%s",
+            "CREATE TABLE node_ways (node_id INTEGER,way_id INTEGER,PRIMARY KEY (node_id,way_id)) WITHOUT ROWID;\n"
+            "INSERT OR IGNORE INTO node_ways SELECT node_id,way_id FROM ways,way_nodes_unpack(ways.nodes) ORDER BY 1,2;\n");
+
+    // R*Trees filled while decoding go into the output database, shard 0
+    for( i=0; i<n_rtrees; i++ ) {
+        RtreeIndex *r = &rtrees[i];
+        if( !r->joined ) {
+            schema.tables[0] = sql_append(schema.tables[0], O5M2SQLITE_RTREE_TABLE, r->table, member_type(r->type));
+            if( r->type!=O5MREADER_DS_NODE ) store_locations = 1;
+            if( r->type==O5MREADER_DS_REL ) store_way_boxes = 1;
+            continue;
+        }
+        // with fixed coordinates the bounding boxes are aggregated on integers
+        cond = r->value ? sqlite3_mprintf("way_tags.key=%Q AND way_tags.value=%Q", r->key, r->value) :
+            sqlite3_mprintf("way_tags.key=%Q", r->key);
+        schema.finish = sql_append(schema.finish, O5M2SQLITE_CREATE_RTREE, cond+9, r->table, "way", r->table,
+            fixed_coords ? "/1E7" : "", fixed_coords ? "/1E7" : "", fixed_coords ? "/1E7" : "", fixed_coords ? "/1E7" : "",
+            fixed_coords ? "nodes_fixed AS nodes" : "nodes    ", cond);
+        sqlite3_free(cond);
+    }
+
+    // the clustered tables are loaded in primary key order
+    if( clustered ) {
+        for( i=0; i<W_COUNT; i++ ) {
+            writers[i].sort_index = NULL;
+            writers[i].cmp = writers[i].cmp_clustered;
+        }
+    }
+}
+
+/* the whole schema as --schema prints it */
+static void print_schema( void ) {
+    int i;
+    fprintf(stderr, "\n");
+    for( i=0; i<3; i++ ) fprintf(stderr, "%s", schema.tables[i]);
+    if( schema.dict_tables ) fprintf(stderr, "%s", schema.dict_tables);
+    fprintf(stderr, "\n");
+    for( i=0; i<3; i++ ) fprintf(stderr, "%s", schema.indexes[i]);
+    if( schema.dict_indexes ) fprintf(stderr, "%s", schema.dict_indexes);
+    fprintf(stderr, "\n%s\n\n", schema.finish ? schema.finish : "");
+}
+
+/* insert the entries of a dictionary that aren't in the database yet */
+static void store_dict( sqlite3 *h, Dict *d, const char *table ) {
+    sqlite3_stmt *stmt;
+    char *sql = sqlite3_mprintf("INSERT INTO %s VALUES (?1,?2);", table);
+    size_t i;
+
+    check_db_rc( h, sqlite3_prepare_v2(h,sql,-1,&stmt,NULL) );
+    sqlite3_free(sql);
+    for( i=d->n_db; i<d->n; i++ ) {
+        sqlite3_bind_int64(stmt,1,i+1);
+        sqlite3_bind_text(stmt,2,d->str+d->offs[i],-1,NULL);
+        step_stmt(stmt, "could not insert dictionary entry.\n", -14);
+    }
+    sqlite3_finalize(stmt);
+    d->n_db = d->n;
+}
+
+static void write_dict( sqlite3 *h, Dict *d, const char *table ) {
+    store_dict(h, d, table);
+    dict_free(d);
+}
+
+/* --update: read a dictionary of the database, its ids have to be 1 .. n */
+static void load_dict( sqlite3 *h, Dict *d, const char *table, const char *column ) {
+    sqlite3_stmt *stmt;
+    char *sql = sqlite3_mprintf("SELECT %s_id,%s FROM %s ORDER BY 1;", column, column, table);
+
+    check_db_rc( h, sqlite3_prepare_v2(h,sql,-1,&stmt,NULL) );
+    sqlite3_free(sql);
+    while( sqlite3_step(stmt)==SQLITE_ROW ) {
+        if( dict_intern(d, (const char *)sqlite3_column_text(stmt,1))!=sqlite3_column_int64(stmt,0) ) {
+            fprintf(stderr, "the ids of dictionary %s are not 1 .. n\n", table);
+            exit(1);
+        }
+    }
+    sqlite3_finalize(stmt);
+    d->n_db = d->n;
+}
+
+/*
+** --checkpoint: the table o5m2sqlite_checkpoint of the output database
+** holds the options of the import, its phase ("import" or "indexes"),
+** the input offset and o5m reader state to continue decoding at, the
+** counts and the number of statements of the index phase done. It is
+** dropped when the import is complete.
+*/
+uint64_t statements_done, statements_run;
+
+static void checkpoint_put_int( sqlite3 *h, const char *key, int64_t value ) {
+    char *sql = sqlite3_mprintf("INSERT OR REPLACE INTO o5m2sqlite_checkpoint VALUES (%Q,%lld);", key, (long long)value);
+    check_db_rc( h, sqlite3_exec(h,sql,NULL,NULL,NULL) );
+    sqlite3_free(sql);
+}
+
+static void checkpoint_put_text( sqlite3 *h, const char *key, const char *value ) {
+    char *sql = sqlite3_mprintf("INSERT OR REPLACE INTO o5m2sqlite_checkpoint VALUES (%Q,%Q);", key, value);
+    check_db_rc( h, sqlite3_exec(h,sql,NULL,NULL,NULL) );
+    sqlite3_free(sql);
+}
+
+static void checkpoint_put_blob( sqlite3 *h, const char *key, const void *value, size_t size ) {
+    sqlite3_stmt *stmt;
+    check_db_rc( h, sqlite3_prepare_v2(h,"INSERT OR REPLACE INTO o5m2sqlite_checkpoint VALUES (?1,?2);",-1,&stmt,NULL) );
+    sqlite3_bind_text(stmt,1,key,-1,NULL);
+    sqlite3_bind_blob64(stmt,2,value,size,NULL);
+    step_stmt(stmt, "could not write checkpoint.\n", -16);
+    sqlite3_finalize(stmt);
+}
+
+/* the statement after the first one of sql, without preparing it */
+static const char *skip_statement( const char *sql ) {
+    const char *p = sql;
+    char *head;
+    int complete;
+
+    while( (p = strchr(p,';'))!=NULL ) {
+        head = sqlite3_mprintf("%.*s", (int)(++p-sql), sql);
+        complete = sqlite3_complete(head);
+        sqlite3_free(head);
+        if( complete ) return p;
+    }
+    return sql+strlen(sql);
+}
+
+/* stage name of an index or insert statement, NULL for other statements */
+static char *statement_stage( const char *sql ) {
+    char name[128];
+
+    // skip the comment lines in front of it
+    while( isspace((unsigned char)*sql) || (sql[0]=='-' && sql[1]=='-') ) {
+        if( *sql!='-' ) sql++;
+        else if( (sql = strchr(sql,'\n'))==NULL ) return NULL;
+    }
+    if( sscanf(sql,"CREATE INDEX %127s",name)==1 || sscanf(sql,"CREATE UNIQUE INDEX %127s",name)==1 )
+        return sqlite3_mprintf("index %s", name);
+    if( sscanf(sql,"INSERT OR IGNORE INTO %127s",name)==1 || sscanf(sql,"INSERT INTO %127s",name)==1 )
+        return sqlite3_mprintf("fill %s", name);
+    return NULL;
+}
+
+/* run the statements of sql one by one, timing each index and insert as its own stage */
+static void exec_stages( sqlite3 *h, const char *sql ) {
+    sqlite3_stmt *stmt;
+    StageClock clock;
+    char *name;
+    int rc;
+
+    while( sql && *sql ) {
+        // --checkpoint: each statement commits with its number, --resume skips the ones done
+        if( checkpoint_interval && h==db ) {
+            while( isspace((unsigned char)*sql) ) sql++;
+            if( *sql==0 ) break;
+            if( ++statements_run<=statements_done ) {
+                sql = skip_statement(sql);
+                continue;
+            }
+            check_db_rc( h, sqlite3_exec(h,"BEGIN TRANSACTION",NULL,NULL,NULL) );
+        }
+        check_db_rc( h, sqlite3_prepare_v2(h,sql,-1,&stmt,&sql) );
+        if( stmt==NULL ) break;
+        name = statement_stage(sqlite3_sql(stmt));
+        stage_start(&clock);
+        while( (rc = sqlite3_step(stmt))==SQLITE_ROW );
+        rc = sqlite3_finalize(stmt);
+        check_db_rc( h, rc );
+        if( checkpoint_interval && h==db ) {
+            checkpoint_put_int(h, "statements", statements_run);
+            check_db_rc( h, sqlite3_exec(h,"COMMIT",NULL,NULL,NULL) );
+        }
+        if( name ) stage_end(name, &clock);
+        sqlite3_free(name);
+    }
+}
+
+/* --dict: create the dictionary tables and views and fill them */
+static void write_dicts( sqlite3 *h ) {
+    StageClock clock;
+
+    if( !dict_encoding ) return;
+    // with --checkpoint the tables exist from the start and every checkpoint stores the new entries
+    if( !checkpoint_interval ) {
+        stage_start(&clock);
+        fprintf(stderr, "\nwrite dictionaries (%u keys, %u values, %u roles)...\n",
+            (unsigned)dict_keys.n, (unsigned)dict_values.n, (unsigned)dict_roles.n);
+        check_db_rc( h, sqlite3_exec(h,"BEGIN TRANSACTION",NULL,NULL,NULL) );
+        check_db_rc( h, sqlite3_exec(h,schema.dict_tables,NULL,NULL,NULL) );
+        write_dict(h, &dict_keys, "keys");
+        write_dict(h, &dict_values, "tag_values");
+        write_dict(h, &dict_roles, "roles");
+        check_db_rc( h, sqlite3_exec(h,"COMMIT",NULL,NULL,NULL) );
+        stage_end("dictionaries", &clock);
+    }
+    else {
+        dict_free(&dict_keys);
+        dict_free(&dict_values);
+        dict_free(&dict_roles);
+    }
+    exec_stages(h, schema.dict_indexes);
+}
+
+/* prepare "insert (?,..),(?,..)..." with n_rows groups of n_cols parameters */
+static sqlite3_stmt *prepare_insert( sqlite3 *h, const char *insert, int n_cols, int n_rows ) {
+    size_t len = strlen(insert);
+    char *sql = malloc(len + (size_t)n_rows*(2*n_cols+2) + 2);
+    char *p;
+    sqlite3_stmt *stmt;
+    int r, c;
+
+    if( sql==NULL ) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    memcpy(sql, insert, len);
+    p = sql + len;
+    for( r=0; r<n_rows; r++ ) {
+        if( r>0 ) *p++ = ',';
+        *p++ = '(';
+        for( c=0; c<n_cols; c++ ) {
+            if( c>0 ) *p++ = ',';
+            *p++ = '?';
+        }
+        *p++ = ')';
+    }
+    *p++ = ';';
+    *p = 0;
+    check_db_rc( h, sqlite3_prepare_v2(h,sql,-1,&stmt,NULL) );
+    free(sql);
+    return stmt;
+}
+
+/* prepare the statements of the writers first .. first+n-1 on database h */
+static void prepare_writers( sqlite3 *h, TableWriter *writers, int first, int n ) {
+    int max_vars = sqlite3_limit(h, SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+    int i;
+    for( i=first; i<first+n; i++ ) {
+        TableWriter *w = &writers[i];
+        if( w->insert==NULL ) continue;
+        w->single = prepare_insert(h, w->insert, w->n_cols, 1);
+        w->multi_rows = insert_rows;
+        if( w->multi_rows*w->n_cols > max_vars ) w->multi_rows = max_vars/w->n_cols;
+        w->multi = w->multi_rows>1 ? prepare_insert(h, w->insert, w->n_cols, w->multi_rows) : NULL;
+        if( sort_memory && w->encode ) w->sorter = sorter_new(sort_memory/N_SORTED_TABLES, w->cmp);
+    }
+}
+
+/* 16 bits of x spread to the even bits */
+static uint32_t spread_bits( uint32_t x ) {
+    x &= 0xffff;
+    x = (x | x<<8) & 0x00ff00ff;
+    x = (x | x<<4) & 0x0f0f0f0f;
+    x = (x | x<<2) & 0x33333333;
+    x = (x | x<<1) & 0x55555555;
+    return x;
+}
+
+/* position of a box center on a Z-order curve */
+static uint32_t box_zorder( const BoxEntry *e ) {
+    uint32_t lat = ((uint32_t)(e->min_lat/2 + e->max_lat/2) ^ 0x80000000u) >> 16;
+    uint32_t lon = ((uint32_t)(e->min_lon/2 + e->max_lon/2) ^ 0x80000000u) >> 16;
+    return spread_bits(lat)<<1 | spread_bits(lon);
+}
+
+static int cmp_box_zorder( const void *a, const void *b ) {
+    return cmp_uint32(box_zorder(a), box_zorder(b));
+}
+
+/*
+** Insert the collected boxes of the R*Tree indexes of an entity type, 0 =
+** all types. They go in Z-order of their centers, so consecutive inserts
+** descend into the same R*Tree nodes.
+*/
+static void rtree_flush( sqlite3 *h, uint8_t type ) {
+    int max_vars = sqlite3_limit(h, SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+    int multi_rows = insert_rows*5 > max_vars ? max_vars/5 : insert_rows;
+    sqlite3_stmt *single, *multi = NULL, *stmt;
+    RtreeIndex *r;
+    BoxEntry *e;
+    StageClock clock;
+    char *insert;
+    size_t i;
+    int k, c;
+
+    for( k=0; k<n_rtrees; k++ ) {
+        r = &rtrees[k];
+        if( (type && r->type!=type) || r->n_pending==0 ) continue;
+        stage_start(&clock);
+        qsort(r->pending, r->n_pending, sizeof(BoxEntry), cmp_box_zorder);
+        insert = sqlite3_mprintf("INSERT INTO %s (%s_id,min_lat,max_lat,min_lon,max_lon) VALUES ",
+            r->table, member_type(r->type));
+        single = prepare_insert(h, insert, 5, 1);
+        if( multi_rows>1 && r->n_pending>=(size_t)multi_rows ) multi = prepare_insert(h, insert, 5, multi_rows);
+        sqlite3_free(insert);
+        for( i=0, c=0; i<r->n_pending; i++ ) {
+            stmt = multi && r->n_pending-i+c>=(size_t)multi_rows ? multi : single;
+            e = &r->pending[i];
+            sqlite3_bind_int64(stmt,5*c+1,e->id);
+            sqlite3_bind_double(stmt,5*c+2,e->min_lat/1E7);
+            sqlite3_bind_double(stmt,5*c+3,e->max_lat/1E7);
+            sqlite3_bind_double(stmt,5*c+4,e->min_lon/1E7);
+            sqlite3_bind_double(stmt,5*c+5,e->max_lon/1E7);
+            if( stmt==multi && ++c<multi_rows ) continue;
+            step_stmt(stmt, "could not insert bounding box.\n", -11);
+            c = 0;
+        }
+        sqlite3_finalize(single);
+        sqlite3_finalize(multi);
+        multi = NULL;
+        r->rows += r->n_pending;
+        r->seconds += now()-clock.wall;
+        insert = sqlite3_mprintf("fill %s", r->table);
+        stage_end(insert, &clock);
+        sqlite3_free(insert);
+        free(r->pending);
+        r->pending = NULL;
+        r->n_pending = r->cap_pending = 0;
+    }
+}
+
+/* R*Tree indexes of the entity types a batch has passed, their sections are complete */
+static void rtree_flush_passed( sqlite3 *h, const Batch *b ) {
+    uint8_t type;
+    for( type=O5MREADER_DS_NODE; type<O5MREADER_DS_REL; type++ )
+        if( b->types >> (type-O5MREADER_DS_NODE+1) ) rtree_flush(h, type);
+}
+
+static void finalize_writers( TableWriter *writers ) {
+    int i;
+    for( i=0; i<W_COUNT; i++ ) {
+        sqlite3_finalize(writers[i].single);
+        sqlite3_finalize(writers[i].multi);
+        writers[i].single = writers[i].multi = NULL;
+    }
+}
+
+/* rows of a batch for the table of writer w */
+static size_t batch_table_rows( const Batch *b, int w ) {
+    switch( w ) {
+        case W_NODES:       return b->n_nodes;
+        case W_NODE_TAGS:   return b->n_node_tags;
+        case W_WAY_NODES:   return packed_ways ? b->n_ways : b->n_way_nodes;
+        case W_WAY_TAGS:    return b->n_way_tags;
+        case W_WAY_GEOMETRY: return b->n_geoms;
+        case W_REL_MEMBERS: return b->n_rel_members;
+        case W_REL_TAGS:    return b->n_rel_tags;
+        default:            return 0;
+    }
+}
+
+static void insert_table_rows( TableWriter *w, const Batch *b, size_t n ) {
+    sqlite3 *h = sqlite3_db_handle(w->single);
+    uint64_t dropped = w->dropped;
+    double t = 0;
+    size_t i = 0;
+    int r;
+
+    if( n==0 ) return;
+    if( insert_stats || bench ) t = now();
+    if( w->multi ) {
+        for( ; i+w->multi_rows<=n; i+=w->multi_rows ) {
+            for( r=0; r<w->multi_rows; r++ ) w->bind(w->multi, r*w->n_cols+1, b, i+r);
+            step_stmt(w->multi, w->errmsg, w->code);
+            if( w->ignore ) w->dropped += w->multi_rows - sqlite3_changes(h);
+        }
+    }
+    for( ; i<n; i++ ) {
+        w->bind(w->single, 1, b, i);
+        step_stmt(w->single, w->errmsg, w->code);
+        if( w->ignore ) w->dropped += 1 - sqlite3_changes(h);
+    }
+    w->rows += n - (w->dropped-dropped);
+    if( insert_stats || bench ) w->seconds += now()-t;
+}
+
+static void write_rows( TableWriter *w, const Batch *b, size_t n ) {
+    size_t i;
+    if( w->sorter==NULL ) {
+        insert_table_rows(w, b, n);
+        return;
+    }
+    for( i=0; i<n; i++ ) w->encode(w->sorter, b, i);
+    if( w->sorter->n_data + 2*w->sorter->n_recs*sizeof(char *) > w->sorter->budget ) sorter_spill(w->sorter);
+}
+
+typedef struct {
+    TableWriter *w;
+    int table;
+    Batch *b;
+} SortedLoad;
+
+static void load_record( const char *rec, void *arg ) {
+    SortedLoad *load = arg;
+    load->w->decode(load->b, rec);
+    if( load->b->rows>=batch_rows ) {
+        insert_table_rows(load->w, load->b, batch_table_rows(load->b, load->table));
+        batch_clear(load->b);
+    }
+}
+
+/*
+** Sorted load: create the sort index of every sorted table on the empty
+** table, then insert its rows in key order so the index only grows at
+** its right edge. In the clustered schema there is no sort index, the
+** rows are sorted by primary key.
+*/
+static void load_sorted( sqlite3 *h, TableWriter *writers, int first, int n ) {
+    SortedLoad load;
+    StageClock clock;
+    char *name;
+    int i;
+
+    load.b = batch_new();
+    for( i=first; i<first+n; i++ ) {
+        load.w = &writers[i];
+        load.table = i;
+        if( load.w->sorter==NULL ) continue;
+        stage_start(&clock);
+        if( load.w->sort_index ) check_db_rc( h, sqlite3_exec(h,load.w->sort_index,NULL,NULL,NULL) );
+        sorter_merge(load.w->sorter, load_record, &load);
+        insert_table_rows(load.w, load.b, batch_table_rows(load.b, i));
+        batch_clear(load.b);
+        sorter_free(load.w->sorter);
+        load.w->sorter = NULL;
+        name = sqlite3_mprintf("sorted load %s", load.w->name);
+        stage_end(name, &clock);
+        sqlite3_free(name);
+    }
+    batch_free(load.b);
+}
+
+/* run index statements, leaving out the ones a sorted load created already */
+static void create_indexes( sqlite3 *h, const char *sql ) {
+    char *todo = sqlite3_mprintf("%s", sql);
+    char *p;
+    size_t len;
+    int i;
+
+    for( i=0; i<W_COUNT && sort_memory; i++ ) {
+        if( writers[i].sort_index==NULL || (p = strstr(todo, writers[i].sort_index))==NULL ) continue;
+        len = strlen(writers[i].sort_index);
+        memmove(p, p+len, strlen(p+len)+1);
+    }
+    exec_stages(h, todo);
+    sqlite3_free(todo);
+}
+
+/*
+** Input. "-" reads stdin. Gzip input, recognized by its first byte 0x1f,
+** is inflated by a thread writing into a pipe whose read end goes to the
+** o5m reader like any other pipe. The reader skips by consuming its own
+** buffer, only --threads (reset scan) and --nodes=referenced (two passes)
+** need a seekable input.
+*/
+#ifndef O5M2SQLITE_OMIT_GZIP
+#define GUNZIP_CHUNK (256*1024)
+
+typedef struct {
+    FILE *in;               /* compressed input */
+    int fd;                 /* write end of the pipe */
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    uint64_t consumed;      /* compressed bytes read so far */
+    int failed;
+} Gunzip;
+
+Gunzip gunzip;
+#endif
+int gunzip_active = 0;
+int input_seekable = 1;
+uint64_t input_size = 0;    /* 0 = unknown, no percentage and ETA */
+
+#ifndef O5M2SQLITE_OMIT_GZIP
+/* write all n bytes to fd, 0 when the reader closed the pipe */
+static int write_all( int fd, const unsigned char *p, size_t n ) {
+    ssize_t w;
+    while( n>0 ) {
+        w = write(fd, p, n);
+        if( w<0 && errno==EINTR ) continue;
+        if( w<=0 ) return 0;
+        p += w;
+        n -= w;
+    }
+    return 1;
+}
+
+static void *gunzip_thread( void *arg ) {
+    Gunzip *g = arg;
+    unsigned char *in = malloc(GUNZIP_CHUNK), *out = malloc(GUNZIP_CHUNK);
+    StageClock clock;
+    z_stream z;
+    size_t n;
+    int rc = Z_OK, closed = 0;
+
+    memset(&z, 0, sizeof(z));
+    if( in==NULL || out==NULL || inflateInit2(&z, 15+32)!=Z_OK ) {
+        fprintf(stderr, "gzip: out of memory\n");
+        g->failed = 1;
+    }
+    while( !g->failed ) {
+        if( z.avail_in==0 ) {
+            if( (n = fread(in, 1, GUNZIP_CHUNK, g->in))==0 ) break;
+            pthread_mutex_lock(&g->mutex);
+            g->consumed += n;
+            pthread_mutex_unlock(&g->mutex);
+            z.next_in = in;
+            z.avail_in = n;
+        }
+        // concatenated gzip members, as written by parallel compressors
+        if( rc==Z_STREAM_END ) inflateReset(&z);
+        z.next_out = out;
+        z.avail_out = GUNZIP_CHUNK;
+        stage_start(&clock);
+        rc = inflate(&z, Z_NO_FLUSH);
+        stage_end("gunzip", &clock);
+        if( rc!=Z_OK && rc!=Z_STREAM_END && rc!=Z_BUF_ERROR ) {
+            fprintf(stderr, "gzip: %s\n", z.msg ? z.msg : "corrupt data");
+            g->failed = 1;
+        }
+        else if( !write_all(g->fd, out, GUNZIP_CHUNK-z.avail_out) ) closed = 1;
+        if( closed ) break;
+    }
+    if( !g->failed && !closed && rc!=Z_STREAM_END ) {
+        fprintf(stderr, ferror(g->in) ? "gzip: read error\n" : "gzip: unexpected end of file\n");
+        g->failed = 1;
+    }
+    inflateEnd(&z);
+    free(in);
+    free(out);
+    close(g->fd);
+    return NULL;
+}
+#endif
+
+/* open an input file, "-" = stdin, NULL if it can't be opened */
+static FILE *input_open( const char *path ) {
+    FILE *f = strcmp(path,"-")==0 ? stdin : fopen(path, "rb");
+    long size;
+    int c;
+
+    if( f==NULL ) return NULL;
+    if( fseek(f,0,SEEK_END)==0 && (size = ftell(f))>=0 ) {
+        input_size = size;
+        rewind(f);
+    }
+    else input_seekable = 0;
+    c = getc(f);
+    ungetc(c, f);
+    if( c!=0x1f ) return f;
+#ifndef O5M2SQLITE_OMIT_GZIP
+    {
+        int fds[2];
+        if( pipe(fds)!=0 ) {
+            fprintf(stderr, "can't create pipe\n");
+            exit(1);
+        }
+        // the thread notices a closed pipe from the failing write
+        signal(SIGPIPE, SIG_IGN);
+        gunzip.in = f;
+        gunzip.fd = fds[1];
+        gunzip.consumed = 0;
+        gunzip.failed = 0;
+        pthread_mutex_init(&gunzip.mutex, NULL);
+        if( pthread_create(&gunzip.thread, NULL, gunzip_thread, &gunzip)!=0 ) {
+            fprintf(stderr, "can't create gzip thread\n");
+            exit(1);
+        }
+        gunzip_active = 1;
+        input_seekable = 0;
+        return fdopen(fds[0], "rb");
+    }
+#else
+    fprintf(stderr, "%s is gzip compressed, compiled without gzip support\n", path);
+    exit(1);
+#endif
+}
+
+/* compressed bytes consumed, for the percentage and ETA of gzip input */
+static uint64_t input_consumed( void ) {
+    uint64_t n = 0;
+#ifndef O5M2SQLITE_OMIT_GZIP
+    pthread_mutex_lock(&gunzip.mutex);
+    n = gunzip.consumed;
+    pthread_mutex_unlock(&gunzip.mutex);
+#endif
+    return n;
+}
+
+/* pipes and gzip input are read once from the start, --nodes=referenced needs two passes */
+static void check_seekable( const char *path ) {
+    if( !input_seekable && referenced_nodes ) {
+        fprintf(stderr, "--nodes=referenced reads the input twice, it needs an uncompressed o5m file, not %s\n", path);
+        exit(1);
+    }
+}
+
+/* close an input of input_open, exit if its decompression failed */
+static void input_close( FILE *f ) {
+    fclose(f);
+#ifndef O5M2SQLITE_OMIT_GZIP
+    if( !gunzip_active ) return;
+    pthread_join(gunzip.thread, NULL);
+    if( gunzip.in!=stdin ) fclose(gunzip.in);
+    gunzip_active = 0;
+    if( gunzip.failed ) exit(1);
+#endif
+}
+
+/*
+** Counts of the written batches for the progress lines of --progress and
+** the JSON of --stats, kept by the database writer thread.
+*/
+typedef struct {
+    uint64_t entities[3], tags, nds, members;
+    uint64_t pos;           /* input bytes consumed */
+} Counts;
+
+Counts counts, counts_printed;
+double progress_interval = 10;
+double import_start, progress_last;
+const char *stats_path = NULL;     /* --stats */
+uint64_t cache_totals[3];   /* page cache hits, misses and writes of closed connections */
+
+/* page cache hits, misses and writes of connection h */
+static void cache_status( sqlite3 *h, uint64_t v[3] ) {
+    static const int ops[3] = { SQLITE_DBSTATUS_CACHE_HIT, SQLITE_DBSTATUS_CACHE_MISS, SQLITE_DBSTATUS_CACHE_WRITE };
+    int cur, hi, i;
+    for( i=0; i<3; i++ ) {
+        v[i] = sqlite3_db_status(h, ops[i], &cur, &hi, 0)==SQLITE_OK ? (uint64_t)cur : 0;
+    }
+}
+
+/* add the page cache counters of a connection about to be closed to cache_totals */
+static void cache_add( sqlite3 *h ) {
+    uint64_t v[3];
+    int i;
+    cache_status(h, v);
+    pthread_mutex_lock(&stages_mutex);
+    for( i=0; i<3; i++ ) cache_totals[i] += v[i];
+    pthread_mutex_unlock(&stages_mutex);
+}
+
+static void print_progress( void ) {
+    static const char *names[3] = { "nodes", "ways", "relations" };
+    double t = now(), dt = t-progress_last, elapsed = t-import_start, eta;
+    uint64_t done = gunzip_active ? input_consumed() : counts.pos, cache[3];
+    int k;
+
+    fprintf(stderr, "%7.0fs", elapsed);
+    if( input_size ) fprintf(stderr, " %5.1f%%", 100.0*done/input_size);
+    fprintf(stderr, " %9.1f MB %7.1f MB/s", counts.pos/1048576.0, dt>0 ? (counts.pos-counts_printed.pos)/1048576.0/dt : 0);
+    for( k=0; k<3; k++ )
+        fprintf(stderr, "  %s %llu (%.0f/s)", names[k], (unsigned long long)counts.entities[k],
+            dt>0 ? (counts.entities[k]-counts_printed.entities[k])/dt : 0);
+    // the shards' connections are busy on their own threads
+    if( db && !sharded ) {
+        cache_status(db, cache);
+        fprintf(stderr, "  cache %.1f%% hits, %llu pages written", cache[0]+cache[1] ? 100.0*cache[0]/(cache[0]+cache[1]) : 0,
+            (unsigned long long)cache[2]);
+    }
+    if( input_size && done>0 && done<input_size ) {
+        eta = elapsed*(input_size-done)/done;
+        fprintf(stderr, "  ETA %d:%02d:%02d", (int)eta/3600, (int)eta/60%60, (int)eta%60);
+    }
+    fprintf(stderr, "\n");
+    counts_printed = counts;
+    progress_last = t;
+}
+
+/* count a batch on the writer thread, print a progress line every progress_interval seconds */
+static void count_batch( const Batch *b ) {
+    int k;
+    for( k=0; k<3; k++ ) counts.entities[k] += b->counts[k];
+    counts.tags += b->n_node_tags + b->n_way_tags + b->n_rel_tags;
+    counts.nds += b->nds;
+    counts.members += b->n_rel_members;
+    if( b->pos>counts.pos ) counts.pos = b->pos;
+    if( progress_interval>0 && now()-progress_last>=progress_interval ) print_progress();
+}
+
+/* insert all rows of a batch */
+static void write_batch( TableWriter *writers, Batch *b ) {
+    StageClock clock;
+    int i;
+
+    count_batch(b);
+    if( store_locations || b->n_boxes ) {
+        stage_start(&clock);
+        locate_batch(b);
+        stage_end("locations", &clock);
+    }
+    rtree_flush_passed(db, b);
+    stage_start(&clock);
+    for( i=0; i<W_COUNT; i++ ) write_rows(&writers[i], b, batch_table_rows(b, i));
+    stage_end("insert", &clock);
+}
+
+/* node location store: mode, size and nodes without a location */
+static void print_locations( void ) {
+    size_t bytes = (locations.mode==LOC_DENSE ? locations.dense_cap*sizeof(Location) : 0) + locations.cap*sizeof(SparseLocation);
+    if( !store_locations ) return;
+    fprintf(stderr, "\nnode locations: %s, %llu nodes, ids %lld .. %lld, %.1f MB%s, %llu way or member nodes without location\n",
+        locations.mode==LOC_DENSE ? "dense" : "sparse", (unsigned long long)locations.stored,
+        (long long)locations.min_id, (long long)locations.max_id, bytes/1048576.0,
+        locations.mode==LOC_DENSE ? " mapped" : "", (unsigned long long)locations.missing);
+    if( locations.negative )
+        fprintf(stderr, "node locations: %llu nodes with negative ids kept in a sparse side store\n", (unsigned long long)locations.negative);
+    if( way_geometry )
+        fprintf(stderr, "way geometry: %llu lines, %llu polygons, %llu ways incomplete, %llu without geometry, %llu nodes without location\n",
+            (unsigned long long)geometry_stats.lines, (unsigned long long)geometry_stats.polygons,
+            (unsigned long long)geometry_stats.incomplete, (unsigned long long)geometry_stats.empty,
+            (unsigned long long)geometry_stats.missing);
+    loc_free(&locations);
+    if( !store_way_boxes ) return;
+    fprintf(stderr, "way boxes: %llu ways, %.1f MB, %llu member ways without box\n",
+        (unsigned long long)(way_boxes.n+way_boxes.n_boxes), box_bytes(&way_boxes)/1048576.0, (unsigned long long)way_boxes.missing);
+    box_free(&way_boxes);
+}
+
+/* --schema=clustered: tag rows dropped for a key their entity has already */
+static void print_dropped( void ) {
+    int i;
+    for( i=0; i<W_COUNT; i++ ) {
+        if( writers[i].dropped==0 ) continue;
+        fprintf(stderr, "warning: %llu %s rows dropped for a duplicate key of their entity, the first value of a key is kept\n",
+            (unsigned long long)writers[i].dropped, writers[i].name);
+    }
+}
+
+static void print_insert_stats( void ) {
+    int i;
+    fprintf(stderr, "\n%-24s %12s %9s %12s\n", "table", "rows", "seconds", "rows/s");
+    for( i=0; i<W_COUNT; i++ ) {
+        TableWriter *w = &writers[i];
+        if( w->insert==NULL ) continue;
+        fprintf(stderr, "%-24s %12llu %9.2f %12.0f\n", w->name, (unsigned long long)w->rows, w->seconds,
+            w->seconds>0 ? w->rows/w->seconds : 0);
+    }
+    for( i=0; i<n_rtrees; i++ ) {
+        RtreeIndex *r = &rtrees[i];
+        if( r->joined ) continue;
+        fprintf(stderr, "%-24s %12llu %9.2f %12.0f\n", r->table, (unsigned long long)r->rows, r->seconds,
+            r->seconds>0 ? r->rows/r->seconds : 0);
+    }
+}
+
+/*
+** Threaded decoding. In parallel mode the input is split at reset points
+** into chunks, chunk i is decoded by worker i % n_workers with its own
+** O5mreader; in pipeline mode a single worker decodes the whole input.
+** Every worker owns a fixed ring of queue_depth batches that cycle between
+** its free list and its filled queue, the writer drains the workers'
+** queues in chunk order. Time spent blocked on either side is recorded.
+*/
+typedef struct BatchQueue {
+    Batch **batches;
+    Batch **filled;
+    Batch **free_list;
+    int head, n_filled, n_free;
+    double decode_stall;    /* seconds the decoder waited for a free batch */
+    double write_stall;     /* seconds the writer waited for a filled batch */
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} BatchQueue;
+
+typedef struct {
+    FILE *f;                /* pipeline mode: decode f from its position */
+    const char *path;       /* parallel mode: open path and decode chunks */
+    const uint64_t *offsets;
+    size_t n_chunks;
+    int index, n_workers;
+    BatchQueue queue;
+    FilterStats stats;
+    pthread_t thread;
+} DecodeWorker;
+
+static void queue_init( BatchQueue *q ) {
+    int i;
+    q->batches = malloc(3*queue_depth*sizeof(Batch *));
+    if( q->batches==NULL ) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    q->filled = q->batches + queue_depth;
+    q->free_list = q->batches + 2*queue_depth;
+    for( i=0; i<queue_depth; i++ ) {
+        q->free_list[i] = q->batches[i] = batch_new();
+        q->batches[i]->owner = q;
+    }
+    q->n_free = queue_depth;
+    q->head = q->n_filled = 0;
+    q->decode_stall = q->write_stall = 0;
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->cond, NULL);
+}
+
+static void queue_destroy( BatchQueue *q ) {
+    int i;
+    for( i=0; i<queue_depth; i++ ) batch_free(q->batches[i]);
+    free(q->batches);
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->cond);
+}
+
+static Batch *queue_get_free( BatchQueue *q ) {
+    Batch *b;
+    double t;
+    pthread_mutex_lock(&q->mutex);
+    if( q->n_free==0 ) {
+        t = now();
+        while( q->n_free==0 ) pthread_cond_wait(&q->cond, &q->mutex);
+        q->decode_stall += now()-t;
+    }
+    b = q->free_list[--q->n_free];
+    pthread_mutex_unlock(&q->mutex);
+    batch_clear(b);
+    return b;
+}
+
+static void queue_put_free( BatchQueue *q, Batch *b ) {
+    pthread_mutex_lock(&q->mutex);
+    q->free_list[q->n_free++] = b;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+static Batch *queue_get_filled( BatchQueue *q ) {
+    Batch *b;
+    double t;
+    pthread_mutex_lock(&q->mutex);
+    if( q->n_filled==0 ) {
+        t = now();
+        while( q->n_filled==0 ) pthread_cond_wait(&q->cond, &q->mutex);
+        q->write_stall += now()-t;
+    }
+    b = q->filled[q->head];
+    q->head = (q->head+1) % queue_depth;
+    q->n_filled--;
+    pthread_mutex_unlock(&q->mutex);
+    return b;
+}
+
+static void queue_put_filled( BatchQueue *q, Batch *b ) {
+    pthread_mutex_lock(&q->mutex);
+    q->filled[(q->head+q->n_filled) % queue_depth] = b;
+    q->n_filled++;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+/*
+** Sharded output. Nodes, ways and relations go into three databases, each
+** with its own connection and writer thread. The first shard is the output
+** file itself, the others are created next to it and copied into it once
+** every shard has built its indexes. A filled batch is handed to every shard
+** it has rows for and goes back to its decoder when the last one is done.
+*/
+typedef struct {
+    const char *suffix;     /* appended to the output path, NULL = output itself */
+    const char *create_tables;
+    const char *create_indexes;
+    int first, n_tables;    /* writers of the shard's tables */
+    char *path;
+    sqlite3 *db;
+    TableWriter writers[W_COUNT];
+    Batch **ring;           /* batches to write, NULL ends the input */
+    int head, n, cap;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
+} Shard;
+
+#define N_SHARDS 3
+
+Shard shards[N_SHARDS] = {
+    { NULL,         NULL, NULL, W_NODES,       2 },
+    { "-ways",      NULL, NULL, W_WAY_NODES,   3 },
+    { "-relations", NULL, NULL, W_REL_MEMBERS, 2 },
+};
+static void shard_push( Shard *s, Batch *b ) {
+    pthread_mutex_lock(&s->mutex);
+    s->ring[(s->head+s->n) % s->cap] = b;
+    s->n++;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+}
+
+static Batch *shard_pop( Shard *s ) {
+    Batch *b;
+    pthread_mutex_lock(&s->mutex);
+    while( s->n==0 ) pthread_cond_wait(&s->cond, &s->mutex);
+    b = s->ring[s->head];
+    s->head = (s->head+1) % s->cap;
+    s->n--;
+    pthread_mutex_unlock(&s->mutex);
+    return b;
+}
+
+static void batch_release( Batch *b ) {
+    BatchQueue *q = b->owner;
+    int done;
+    pthread_mutex_lock(&q->mutex);
+    done = --b->refs==0;
+    pthread_mutex_unlock(&q->mutex);
+    if( done ) queue_put_free(q, b);
+}
+
+/* hand a filled batch to the shards it has rows for */
+static void shards_dispatch( Batch *b ) {
+    int use[N_SHARDS];
+    StageClock clock;
+    int i, t, refs = 0;
+
+    count_batch(b);
+    if( store_locations || b->n_boxes ) {
+        stage_start(&clock);
+        locate_batch(b);
+        stage_end("locations", &clock);
+    }
+    for( i=0; i<N_SHARDS; i++ ) {
+        use[i] = 0;
+        for( t=shards[i].first; t<shards[i].first+shards[i].n_tables; t++ )
+            if( batch_table_rows(b, t)>0 ) use[i] = 1;
+        refs += use[i];
+    }
+    if( refs==0 ) {
+        queue_put_free(b->owner, b);
+        return;
+    }
+    b->refs = refs;
+    for( i=0; i<N_SHARDS; i++ ) if( use[i] ) shard_push(&shards[i], b);
+}
+
+static void *shard_writer( void *arg ) {
+    Shard *s = arg;
+    Batch *b;
+    StageClock clock;
+    double t;
+    int i;
+
+    while( (b = shard_pop(s))!=NULL ) {
+        stage_start(&clock);
+        for( i=s->first; i<s->first+s->n_tables; i++ ) write_rows(&s->writers[i], b, batch_table_rows(b, i));
+        stage_end("insert", &clock);
+        batch_release(b);
+    }
+    load_sorted(s->db, s->writers, s->first, s->n_tables);
+    finalize_writers(s->writers);
+    stage_start(&clock);
+    check_db_rc( s->db, sqlite3_exec(s->db,"COMMIT",NULL,NULL,NULL) );
+    stage_end("commit", &clock);
+    t = now();
+    create_indexes(s->db, s->create_indexes);
+    fprintf(stderr, "\nindexes of shard %s created in %.2fs\n", s->path, now()-t);
+    cache_add(s->db);
+    sqlite3_close(s->db);
+    return NULL;
+}
+
+/* create the shard databases and start their writers, max_batches = batches in flight */
+static void shards_open( const char *out, int max_batches ) {
+    size_t len = strlen(out);
+    int i;
+
+    for( i=0; i<N_SHARDS; i++ ) {
+        Shard *s = &shards[i];
+        s->path = malloc(len + (s->suffix ? strlen(s->suffix) : 0) + 1);
+        // one more slot for the NULL that ends the input
+        s->ring = malloc((max_batches+1)*sizeof(Batch *));
+        if( s->path==NULL || s->ring==NULL ) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        strcpy(s->path, out);
+        if( s->suffix ) {
+            strcat(s->path, s->suffix);
+            remove(s->path);
+        }
+        s->create_tables = schema.tables[i];
+        s->create_indexes = schema.indexes[i];
+        s->cap = max_batches+1;
+        s->head = s->n = 0;
+        memcpy(s->writers, writers, sizeof(writers));
+        s->db = open_db(s->path);
+        check_db_rc( s->db, sqlite3_exec(s->db,"BEGIN TRANSACTION",NULL,NULL,NULL) );
+        check_db_rc( s->db, sqlite3_exec(s->db,s->create_tables,NULL,NULL,NULL) );
+        prepare_writers(s->db, s->writers, s->first, s->n_tables);
+        pthread_mutex_init(&s->mutex, NULL);
+        pthread_cond_init(&s->cond, NULL);
+        if( pthread_create(&s->thread, NULL, shard_writer, s)!=0 ) {
+            fprintf(stderr, "can't create shard writer thread\n");
+            exit(1);
+        }
+    }
+}
+
+/* end the shards' input and wait until they are written and indexed */
+static void shards_join( void ) {
+    int i, t;
+
+    for( i=0; i<N_SHARDS; i++ ) shard_push(&shards[i], NULL);
+    for( i=0; i<N_SHARDS; i++ ) {
+        pthread_join(shards[i].thread, NULL);
+        for( t=shards[i].first; t<shards[i].first+shards[i].n_tables; t++ ) {
+            writers[t].rows = shards[i].writers[t].rows;
+            writers[t].dropped = shards[i].writers[t].dropped;
+            writers[t].seconds = shards[i].writers[t].seconds;
+        }
+    }
+}
+
+/* copy the other shards into the first one, the output database */
+static void shards_combine( void ) {
+    char *sql;
+    int i, t;
+
+    // identical tables and indexes let sqlite copy the b-trees in key order
+    fprintf(stderr, "combine shards...\n");
+    db = open_db(shards[0].path);
+    for( i=1; i<N_SHARDS; i++ ) {
+        Shard *s = &shards[i];
+        sql = sqlite3_mprintf("ATTACH %Q AS shard", s->path);
+        check_rc( sqlite3_exec(db,sql,NULL,NULL,NULL) );
+        sqlite3_free(sql);
+        check_rc( sqlite3_exec(db,"BEGIN TRANSACTION",NULL,NULL,NULL) );
+        check_rc( sqlite3_exec(db,s->create_tables,NULL,NULL,NULL) );
+        check_rc( sqlite3_exec(db,s->create_indexes,NULL,NULL,NULL) );
+        for( t=s->first; t<s->first+s->n_tables; t++ ) {
+            if( writers[t].insert==NULL ) continue;
+            sql = sqlite3_mprintf("INSERT INTO main.%s SELECT * FROM shard.%s", writers[t].name, writers[t].name);
+            check_rc( sqlite3_exec(db,sql,NULL,NULL,NULL) );
+            sqlite3_free(sql);
+        }
+        check_rc( sqlite3_exec(db,"COMMIT",NULL,NULL,NULL) );
+        check_rc( sqlite3_exec(db,"DETACH shard",NULL,NULL,NULL) );
+        remove(s->path);
+    }
+    for( i=0; i<N_SHARDS; i++ ) {
+        pthread_mutex_destroy(&shards[i].mutex);
+        pthread_cond_destroy(&shards[i].cond);
+        free(shards[i].ring);
+        free(shards[i].path);
+    }
+}
+
+static void *decode_worker( void *arg ) {
+    DecodeWorker *w = arg;
+    O5mreader *reader;
+    O5mreaderEntity *entity;
+    O5mreaderIterateRet ret;
+    O5mreaderRet opened;
+    PairCache *cache = dict_encoding ? pair_cache_new() : NULL;
+    Batch *b;
+    StageClock clock;
+    FILE *f;
+    size_t chunk;
+
+    f = w->f ? w->f : fopen(w->path, "rb");
+    for( chunk=w->index; chunk<w->n_chunks; chunk+=w->n_workers ) {
+        b = queue_get_free(&w->queue);
+        stage_start(&clock);
+        if( f==NULL ) opened = O5MREADER_RET_ERR;
+        else if( w->offsets ) opened = o5mreader_openRange(&reader, f, w->offsets[chunk], w->offsets[chunk+1]);
+        else opened = o5mreader_open(&reader, f);
+        if( opened==O5MREADER_RET_ERR ) {
+            b->n_str = 0;
+            batch_str(b, f==NULL ? "can't open o5m file" : "can't open o5m chunk");
+            b->error = b->last = 1;
+            queue_put_filled(&w->queue, b);
+            continue;
+        }
+        if( cache ) memset(cache, 0, sizeof(PairCache));
+        if( filtering ) o5mreader_setFilter(reader, filter_entity, &w->stats);
+        while( (ret = o5mreader_readEntity(reader, &entity)) == O5MREADER_ITERATE_RET_NEXT ) {
+            batch_entity(b, entity, cache);
+            if( b->rows>=batch_rows ) {
+                b->pos = o5mreader_tell(reader);
+                stage_end("decode", &clock);
+                queue_put_filled(&w->queue, b);
+                b = queue_get_free(&w->queue);
+                stage_start(&clock);
+            }
+        }
+        if( ret==O5MREADER_ITERATE_RET_ERR ) batch_set_error(b, reader);
+        b->last = 1;
+        b->pos = o5mreader_tell(reader);
+        stage_end("decode", &clock);
+        queue_put_filled(&w->queue, b);
+        o5mreader_close(reader);
+    }
+    if( f && !w->f ) fclose(f);
+    free(cache);
+    return NULL;
+}
+
+/*
+** Decode with n_workers threads (offsets!=NULL: one chunk per entry pair,
+** otherwise the whole file f on one thread) and insert everything in file order.
+*/
+static void import_threaded( FILE *f, const char *path, const uint64_t *offsets, size_t n_chunks, int n_workers ) {
+    DecodeWorker *workers;
+    Batch *b;
+    double decode_stall = 0, write_stall = 0;
+    size_t chunk;
+    int i, last;
+
+    workers = calloc(n_workers, sizeof(DecodeWorker));
+    if( workers==NULL ) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    for( i=0; i<n_workers; i++ ) {
+        workers[i].f = offsets ? NULL : f;
+        workers[i].path = path;
+        workers[i].offsets = offsets;
+        workers[i].n_chunks = n_chunks;
+        workers[i].index = i;
+        workers[i].n_workers = n_workers;
+        queue_init(&workers[i].queue);
+        if( pthread_create(&workers[i].thread, NULL, decode_worker, &workers[i])!=0 ) {
+            fprintf(stderr, "can't create decode thread\n");
+            exit(1);
+        }
+    }
+
+    for( chunk=0; chunk<n_chunks; chunk++ ) {
+        BatchQueue *q = &workers[chunk % n_workers].queue;
+        do {
+            b = queue_get_filled(q);
+            if( b->error ) {
+                fprintf(stderr, "o5m read error: %s\n", b->str);
+                sqlite3_close(db);
+                exit(1);
+            }
+            last = b->last;
+            if( sharded ) shards_dispatch(b);
+            else {
+                write_batch(writers, b);
+                queue_put_free(q, b);
+            }
+        } while( !last );
+    }
+
+    // the shard writers may still hold batches of the workers' queues
+    if( sharded ) shards_join();
+    for( i=0; i<n_workers; i++ ) {
+        pthread_join(workers[i].thread, NULL);
+        decode_stall += workers[i].queue.decode_stall;
+        write_stall += workers[i].queue.write_stall;
+        queue_destroy(&workers[i].queue);
+        filter_stats_add(&workers[i].stats);
+    }
+    free(workers);
+    fprintf(stderr, "\ndecode stall %.2fs (summed over %d threads), write stall %.2fs\n",
+        decode_stall, n_workers, write_stall);
+}
+
+static void import_parallel( FILE *f, const char *path, int n_workers ) {
+    uint64_t *offsets;
+    size_t n_chunks;
+
+    if( o5mreader_scanResets(f, O5M2SQLITE_MIN_CHUNK, &offsets, &n_chunks)==O5MREADER_RET_ERR ) {
+        fprintf(stderr, "can't scan o5m file %s\n", path);
+        exit(1);
+    }
+    n_chunks--;
+    fprintf(stderr, "decode %d chunks with %d threads...\n", (int)n_chunks, n_workers);
+    import_threaded(f, path, offsets, n_chunks, n_workers);
+    free(offsets);
+}
+
+/* --resume: where decoding continues, read by resume_load() */
+uint64_t resume_offset;
+void *resume_state;         size_t resume_state_size;
+
+/*
+** Record a checkpoint in the current transaction: the pending R*Tree boxes
+** and new dictionary entries are written, then the offset and state of
+** reader after the entity read last (reader NULL: the input is done).
+*/
+static void checkpoint_save( O5mreader *reader, const char *phase ) {
+    StageClock clock;
+    void *state;
+    size_t size;
+
+    stage_start(&clock);
+    rtree_flush(db, 0);
+    if( dict_encoding ) {
+        store_dict(db, &dict_keys, "keys");
+        store_dict(db, &dict_values, "tag_values");
+        store_dict(db, &dict_roles, "roles");
+    }
+    if( reader ) {
+        size = o5mreader_stateSize(reader);
+        if( (state = malloc(size))==NULL ) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        checkpoint_put_int(db, "offset", o5mreader_saveState(reader, state));
+        checkpoint_put_blob(db, "reader", state, size);
+        free(state);
+    }
+    checkpoint_put_int(db, "nodes", counts.entities[0]);
+    checkpoint_put_int(db, "ways", counts.entities[1]);
+    checkpoint_put_int(db, "relations", counts.entities[2]);
+    checkpoint_put_int(db, "tags", counts.tags);
+    checkpoint_put_int(db, "way_nodes", counts.nds);
+    checkpoint_put_int(db, "members", counts.members);
+    checkpoint_put_text(db, "phase", phase);
+    stage_end("checkpoint", &clock);
+}
+
+/* decode and insert on the calling thread */
+static void import_sequential( FILE *f ) {
+    O5mreader* reader;
+    O5mreaderEntity *entity;
+    O5mreaderIterateRet ret;
+    Batch *b = batch_new();
+    PairCache *cache = dict_encoding ? pair_cache_new() : NULL;
+    FilterStats stats;
+    StageClock clock;
+    uint64_t since_checkpoint = 0;
 
-#define O5M2SQLITE_HELP \
-"o5m2sqlite (Version " O5M2SQLITE_VERSION ")\n\n" \
-"Converts OpenStreetMap data in binary o5m format into a SQLite database.\n" \
-"(SQLite Version " SQLITE_VERSION ")\n\n" \
-"Usage:\n" \
-"o5m2sqlite in.o5m out.sqlite3\tconvert in.o5m to out.sqlite3\n" \
-"o5m2sqlite --schema\t\tshow the resulting sqlite database schema\n\n" \
-"(compile time: " __DATE__ " " __TIME__ "  gcc " __VERSION__ ")\n"
+    if( !resuming ) {
+        if( o5mreader_open(&reader,f)==O5MREADER_RET_ERR ) {
+            // reader is NULL if it could not be allocated
+            fprintf(stderr, "o5m read error: %s\n", reader ? o5mreader_strerror(reader->errCode) : "out of memory");
+            sqlite3_close(db);
+            exit(1);
+        }
+    }
+    else if( o5mreader_openState(&reader, f, resume_offset, resume_state, resume_state_size)==O5MREADER_RET_ERR ) {
+        fprintf(stderr, "can't continue reading the o5m file at offset %llu\n", (unsigned long long)resume_offset);
+        sqlite3_close(db);
+        exit(1);
+    }
+    memset(&stats, 0, sizeof(stats));
+    if( filtering ) o5mreader_setFilter(reader, filter_entity, &stats);
 
-/* sqlite db handler */
-sqlite3 *db;
+    // iterate over the o5m file entries
+    stage_start(&clock);
+    while( (ret = o5mreader_readEntity(reader, &entity)) == O5MREADER_ITERATE_RET_NEXT ) {
+        batch_entity(b, entity, cache);
+        since_checkpoint++;
+        if( b->rows>=batch_rows || since_checkpoint==checkpoint_interval ) {
+            b->pos = o5mreader_tell(reader);
+            stage_end("decode", &clock);
+            write_batch(writers, b);
+            batch_clear(b);
+            if( since_checkpoint==checkpoint_interval ) {
+                checkpoint_save(reader, "import");
+                stage_start(&clock);
+                check_rc( sqlite3_exec(db,"COMMIT",NULL,NULL,NULL) );
+                check_rc( sqlite3_exec(db,"BEGIN TRANSACTION",NULL,NULL,NULL) );
+                stage_end("commit", &clock);
+                since_checkpoint = 0;
+            }
+            stage_start(&clock);
+        }
+    } // end of o5m elements iteration
+    b->pos = o5mreader_tell(reader);
+    stage_end("decode", &clock);
+    if( ret==O5MREADER_ITERATE_RET_ERR ) {
+        fprintf(stderr, "o5m read error: %s\n", o5mreader_strerror(reader->errCode));
+        sqlite3_close(db);
+        exit(1);
+    }
+    write_batch(writers, b);
 
-static void check_rc( int rc ) {
-    if( rc!=SQLITE_OK ) {
-        fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+    o5mreader_close(reader);
+    batch_free(b);
+    free(cache);
+    filter_stats_add(&stats);
+}
+
+/* append s to the sqlite3_mprintf string json with the escapes of a JSON string */
+static char *json_append( char *json, const char *s ) {
+    for( ; *s; s++ ) {
+        if( *s=='"' || *s=='\\' ) json = sqlite3_mprintf("%z\\%c", json, *s);
+        else if( (unsigned char)*s>=0x20 ) json = sqlite3_mprintf("%z%c", json, *s);
+    }
+    return json;
+}
+
+/* the command line as JSON string for --bench */
+static char *bench_quote( int narg, char *arg[] ) {
+    char *args = sqlite3_mprintf("%s", "");
+    int i;
+
+    for( i=1; i<narg; i++ ) {
+        if( i>1 ) args = sqlite3_mprintf("%z ", args);
+        args = json_append(args, arg[i]);
+    }
+    return args;
+}
+
+static double max_rss_mb( void ) {
+#if !defined(_WIN32)
+    struct rusage ru;
+    if( getrusage(RUSAGE_SELF, &ru)==0 ) return ru.ru_maxrss/1024.0;
+#endif
+    return 0;
+}
+
+/*
+** Split memory_plan.total: a 64th for the read buffer of every decode
+** thread if the input is a pipe (files are memory mapped), up to a 16th for
+** the batch queues, which lowers --queue-depth if it wasn't given, and
+** --sort-memory. Of the rest 3/8 go to the page caches, the same again, up
+** to SQLite's limit, to the CREATE INDEX sorts and the remainder to mmap.
+** Exits when the fixed parts take more than half of the budget.
+*/
+static void plan_memory( int threads, int queued ) {
+    MemoryPlan *m = &memory_plan;
+    uint64_t batch = (uint64_t)batch_rows*O5M2SQLITE_BATCH_ROW_BYTES;
+    uint64_t fixed, rest;
+
+    m->connections = sharded ? 3 : 1;
+    m->readers = threads;
+    m->input = 0;
+    if( !input_seekable ) {
+        m->input = m->total/64;
+        if( m->input<O5MREADER_BUFFER_SIZE ) m->input = O5MREADER_BUFFER_SIZE;
+        if( m->input>64*1024*1024 ) m->input = 64*1024*1024;
+        o5mreader_setBufferSize(m->input);
+    }
+    if( queued ) {
+        while( !queue_depth_set && queue_depth>2 && (uint64_t)threads*queue_depth*batch > m->total/16 ) queue_depth--;
+        m->queues = (uint64_t)threads*queue_depth*batch;
+    }
+    else m->queues = batch;
+    fixed = m->input*m->readers + m->queues + sort_memory;
+    if( fixed > m->total/2 ) {
+        fprintf(stderr, "--memory=%llu is too small: %llu MB go to input buffers, batch queues and --sort-memory\n",
+            (unsigned long long)(m->total>>20), (unsigned long long)(fixed>>20));
+        exit(1);
+    }
+    rest = m->total - fixed;
+    m->cache = rest*3/8/m->connections;
+    m->index_sort = m->cache<O5M2SQLITE_MAX_SORT_MEMORY ? m->cache : O5M2SQLITE_MAX_SORT_MEMORY;
+    m->mmap = (rest - (m->cache+m->index_sort)*m->connections)/m->connections;
+    fprintf(stderr, "memory %llu MB: page cache %d x %llu MB, index sorts %d x %llu MB, mmap %d x %llu MB,\n",
+        (unsigned long long)(m->total>>20), m->connections, (unsigned long long)(m->cache>>20),
+        m->connections, (unsigned long long)(m->index_sort>>20), m->connections, (unsigned long long)(m->mmap>>20));
+    if( m->input ) fprintf(stderr, "    input buffers %d x %llu MB,", m->readers, (unsigned long long)(m->input>>20));
+    else fprintf(stderr, "    input mapped,");
+    if( queued ) fprintf(stderr, " batch queues %.1f MB (depth %d),", m->queues/(1024.0*1024.0), queue_depth);
+    else fprintf(stderr, " one batch %.1f MB,", m->queues/(1024.0*1024.0));
+    fprintf(stderr, " sort memory %llu MB\n", (unsigned long long)(sort_memory>>20));
+}
+
+/* --memory: the peak use, the resident size includes the mapped input and database pages */
+static void print_memory( void ) {
+    if( memory_plan.total==0 ) return;
+    fprintf(stderr, "memory peak: %.1f MB resident, %.1f MB SQLite heap\n",
+        max_rss_mb(), sqlite3_memory_highwater(0)/(1024.0*1024.0));
+}
+
+static void bench_stage( const char *name, double seconds, uint64_t n, const char *unit, uint64_t bytes ) {
+    printf(",\"%s\":{\"seconds\":%.3f,\"%s_per_s\":%.0f", name, seconds, unit, seconds>0 ? n/seconds : 0);
+    if( bytes ) printf(",\"mb_per_s\":%.2f", seconds>0 ? bytes/1048576.0/seconds : 0);
+    printf("}");
+}
+
+/*
+** --bench: one line of JSON on stdout with the input size, the stages that
+** ran (seconds < 0: not run) and the peak resident memory. decode is the
+** decoding of --dry-run, import the wall time of decoding and inserting,
+** insert the time spent in the insert statements alone (over all threads
+** with --shards) and index the indexes, dictionaries and R*Trees built
+** after the import.
+*/
+static void print_bench( const char *mode, uint64_t bytes, uint64_t entities, double decode, double import, double index ) {
+    uint64_t rows = 0;
+    double insert = 0;
+    int i;
+
+    for( i=0; i<W_COUNT; i++ ) {
+        rows += writers[i].rows;
+        insert += writers[i].seconds;
+    }
+    for( i=0; i<n_rtrees; i++ ) {
+        if( rtrees[i].joined ) continue;
+        rows += rtrees[i].rows;
+        insert += rtrees[i].seconds;
+    }
+    printf("{\"version\":\"%s\",\"sqlite\":\"%s\",\"compiled\":\"%s %s\",\"mode\":\"%s\",\"args\":\"%s\",\"bytes\":%llu,\"entities\":%llu",
+        O5M2SQLITE_VERSION, sqlite3_libversion(), __DATE__, __TIME__, mode, bench_args,
+        (unsigned long long)bytes, (unsigned long long)entities);
+    if( decode>=0 ) bench_stage("decode", decode, entities, "entities", bytes);
+    if( import>=0 ) {
+        bench_stage("import", import, entities, "entities", bytes);
+        bench_stage("insert", insert, rows, "rows", 0);
+    }
+    if( index>=0 ) bench_stage("index", index, rows, "rows", 0);
+    printf(",\"max_rss_mb\":%.1f}\n", max_rss_mb());
+    fflush(stdout);
+}
+
+/* wall and CPU time per stage at the end */
+static void print_stages( void ) {
+    int i;
+
+    if( n_stages==0 ) return;
+    fprintf(stderr, "\n%-40s %10s %10s %8s\n", "stage", "seconds", "cpu", "runs");
+    for( i=0; i<n_stages; i++ )
+        fprintf(stderr, "%-40s %10.2f %10.2f %8llu\n", stages[i].name, stages[i].wall, stages[i].cpu,
+            (unsigned long long)stages[i].runs);
+}
+
+/*
+** --stats: the counts, the stages and the page cache counters of the run
+** as JSON, written at the end. cpu_seconds of the run is the process CPU
+** time over all threads.
+*/
+static void write_stats( const char *path, const char *input, double seconds ) {
+    FILE *out = strcmp(path,"-")==0 ? stdout : fopen(path, "w");
+    char *name = json_append(sqlite3_mprintf("%s", ""), input);
+    struct timespec ts;
+    int i;
+
+    if( out==NULL ) {
+        fprintf(stderr, "can't write statistics file %s\n", path);
+        sqlite3_free(name);
+        return;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    fprintf(out, "{\n  \"version\": \"%s\",\n  \"sqlite\": \"%s\",\n  \"input\": \"%s\",\n",
+        O5M2SQLITE_VERSION, sqlite3_libversion(), name);
+    fprintf(out, "  \"input_bytes\": %llu,\n  \"bytes_read\": %llu,\n", (unsigned long long)input_size,
+        (unsigned long long)counts.pos);
+    fprintf(out, "  \"seconds\": %.3f,\n  \"cpu_seconds\": %.3f,\n  \"max_rss_mb\": %.1f,\n",
+        seconds, ts.tv_sec + ts.tv_nsec/1E9, max_rss_mb());
+    fprintf(out, "  \"memory_mb\": %llu,\n  \"sqlite_heap_peak_mb\": %.1f,\n",
+        (unsigned long long)(memory_plan.total>>20), sqlite3_memory_highwater(0)/(1024.0*1024.0));
+    fprintf(out, "  \"nodes\": %llu,\n  \"ways\": %llu,\n  \"relations\": %llu,\n",
+        (unsigned long long)counts.entities[0], (unsigned long long)counts.entities[1], (unsigned long long)counts.entities[2]);
+    fprintf(out, "  \"tags\": %llu,\n  \"way_nodes\": %llu,\n  \"members\": %llu,\n",
+        (unsigned long long)counts.tags, (unsigned long long)counts.nds, (unsigned long long)counts.members);
+    fprintf(out, "  \"cache\": { \"hits\": %llu, \"misses\": %llu, \"pages_written\": %llu },\n",
+        (unsigned long long)cache_totals[0], (unsigned long long)cache_totals[1], (unsigned long long)cache_totals[2]);
+    fprintf(out, "  \"stages\": [");
+    for( i=0; i<n_stages; i++ )
+        fprintf(out, "%s\n    { \"name\": \"%s\", \"seconds\": %.3f, \"cpu_seconds\": %.3f, \"runs\": %llu }",
+            i ? "," : "", stages[i].name, stages[i].wall, stages[i].cpu, (unsigned long long)stages[i].runs);
+    fprintf(out, "\n  ]\n}\n");
+    if( out!=stdout ) fclose(out);
+    else fflush(out);
+    sqlite3_free(name);
+}
+
+/* --dry-run: decode and filter only, report what would be imported and how fast */
+static void import_dry_run( FILE *f ) {
+    O5mreader* reader;
+    O5mreaderEntity *entity;
+    O5mreaderIterateRet ret;
+    uint64_t start = ftell(f) < 0 ? 0 : ftell(f), bytes, entities;
+    double t = now(), seconds;
+    FilterStats stats;
+
+    memset(&stats, 0, sizeof(stats));
+    filtering = 1;
+    if( o5mreader_open(&reader,f)==O5MREADER_RET_ERR ) {
+        fprintf(stderr, "can't read o5m file\n");
+        exit(1);
+    }
+    o5mreader_setFilter(reader, filter_entity, &stats);
+    while( (ret = o5mreader_readEntity(reader, &entity)) == O5MREADER_ITERATE_RET_NEXT );
+    if( ret==O5MREADER_ITERATE_RET_ERR ) {
+        fprintf(stderr, "o5m read error: %s\n", o5mreader_strerror(reader->errCode));
+        exit(1);
+    }
+    bytes = o5mreader_tell(reader) - start;
+    o5mreader_close(reader);
+    seconds = now()-t;
+    entities = stats.seen[0]+stats.seen[1]+stats.seen[2];
+    filter_stats_add(&stats);
+    print_filter_stats();
+    fprintf(stderr, "decoded %.1f MB in %.2fs: %.1f MB/s, %.0f entities/s\n", bytes/1048576.0, seconds,
+        seconds>0 ? bytes/1048576.0/seconds : 0, seconds>0 ? entities/seconds : 0);
+    if( bench ) print_bench("dry-run", bytes, entities, seconds, -1, -1);
+}
+
+/*
+** --update: apply an o5c change file to a database imported with the same
+** layout options. Every entity of the file replaces the rows of its id, an
+** entity without body (ds.isEmpty) only deletes them. The changed ids are
+** collected in temp tables, from which the R*Tree boxes of the changed
+** entities and of the ways and relations of moved nodes are recomputed at
+** the end. Lookups go through the id indexes of the import, and all of it
+** is one transaction.
+*/
+/* id column per writer, the writers come in pairs per entity type */
+static const char *update_ids[W_COUNT] = { "node_id", "node_id", "way_id", "way_id", "way_id", "relation_id", "relation_id" };
+static const int update_types[W_COUNT] = { 0, 0, 1, 1, 1, 2, 2 };
+
+static int db_has_table( sqlite3 *h, const char *name ) {
+    sqlite3_stmt *stmt;
+    int found;
+
+    check_db_rc( h, sqlite3_prepare_v2(h,"SELECT 1 FROM sqlite_master WHERE type='table' AND name=?1;",-1,&stmt,NULL) );
+    sqlite3_bind_text(stmt,1,name,-1,NULL);
+    found = sqlite3_step(stmt)==SQLITE_ROW;
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+/* run an sqlite3_mprintf statement and free it, returns the rows changed */
+static int exec_update( sqlite3 *h, char *sql ) {
+    check_db_rc( h, sqlite3_exec(h,sql,NULL,NULL,NULL) );
+    sqlite3_free(sql);
+    return sqlite3_changes(h);
+}
+
+static sqlite3_stmt *prepare_update( sqlite3 *h, char *sql ) {
+    sqlite3_stmt *stmt;
+    check_db_rc( h, sqlite3_prepare_v2(h,sql,-1,&stmt,NULL) );
+    sqlite3_free(sql);
+    return stmt;
+}
+
+/*
+** Recompute the boxes of the affected entities in the R*Tree indexes: the
+** changed nodes, the changed ways and the ways of changed nodes, the
+** changed relations, the relations with such a node, way or relation
+** member and so on up. A relation's box takes in the members of its
+** member relations and theirs, UNION keeps cycles finite.
+*/
+static void update_rtrees( sqlite3 *h, int has_node_ways ) {
+    const char *members = writers[W_REL_MEMBERS].name;
+    const char *node_type = dict_encoding ? "0" : "'node'";
+    const char *way_type = dict_encoding ? "1" : "'way'";
+    const char *rel_type = dict_encoding ? "2" : "'relation'";
+    uint8_t types = 0;
+    RtreeIndex *r;
+    char *cond, *select;
+    int i, removed, added;
+
+    for( i=0; i<n_rtrees; i++ ) types |= 1 << (rtrees[i].type-O5MREADER_DS_NODE);
+    if( types & 6 ) {
+        exec_update(h, sqlite3_mprintf("%s",
+            "CREATE TEMP TABLE affected_ways (way_id INTEGER PRIMARY KEY);\n"
+            "INSERT INTO affected_ways SELECT way_id FROM changed_ways;"));
+        // without node_ways the packed node lists of all ways are scanned
+        if( packed_ways && !has_node_ways )
+            fprintf(stderr, "no node_ways table, scanning all ways for the changed nodes (see --node-ways)...\n");
+        exec_update(h, sqlite3_mprintf("INSERT OR IGNORE INTO affected_ways SELECT way_id FROM %s WHERE node_id IN (SELECT node_id FROM changed_nodes);",
+            has_node_ways ? "node_ways" : "way_nodes"));
+    }
+    if( types & 4 ) {
+        exec_update(h, sqlite3_mprintf(
+            "CREATE TEMP TABLE affected_relations (relation_id INTEGER PRIMARY KEY);\n"
+            "INSERT INTO affected_relations SELECT relation_id FROM changed_relations;\n"
+            "INSERT OR IGNORE INTO affected_relations SELECT relation_id FROM %s WHERE type=%s AND ref IN (SELECT node_id FROM changed_nodes);\n"
+            "INSERT OR IGNORE INTO affected_relations SELECT relation_id FROM %s WHERE type=%s AND ref IN (SELECT way_id FROM affected_ways);\n"
+            "INSERT OR IGNORE INTO affected_relations WITH RECURSIVE up(relation_id) AS (SELECT relation_id FROM affected_relations "
+            "UNION SELECT m.relation_id FROM up JOIN %s m ON m.type=%s AND m.ref=up.relation_id) SELECT relation_id FROM up;",
+            members, node_type, members, way_type, members, rel_type));
+    }
+
+    for( i=0; i<n_rtrees; i++ ) {
+        r = &rtrees[i];
+        cond = strcmp(r->key,"*")==0 ? sqlite3_mprintf("1") : r->value ?
+            sqlite3_mprintf("EXISTS (SELECT 1 FROM %s_tags t WHERE t.%s_id=x.%s_id AND t.key=%Q AND t.value=%Q)",
+                member_type(r->type), member_type(r->type), member_type(r->type), r->key, r->value) :
+            sqlite3_mprintf("EXISTS (SELECT 1 FROM %s_tags t WHERE t.%s_id=x.%s_id AND t.key=%Q)",
+                member_type(r->type), member_type(r->type), member_type(r->type), r->key);
+        switch( r->type ) {
+            case O5MREADER_DS_NODE:
+                removed = exec_update(h, sqlite3_mprintf("DELETE FROM %s WHERE node_id IN (SELECT node_id FROM changed_nodes);", r->table));
+                select = sqlite3_mprintf("SELECT x.node_id,n.lat,n.lat,n.lon,n.lon FROM changed_nodes x "
+                    "JOIN nodes n ON n.node_id=x.node_id WHERE %s", cond);
+                break;
+            case O5MREADER_DS_WAY:
+                removed = exec_update(h, sqlite3_mprintf("DELETE FROM %s WHERE way_id IN (SELECT way_id FROM affected_ways);", r->table));
+                select = sqlite3_mprintf("SELECT x.way_id,min(n.lat),max(n.lat),min(n.lon),max(n.lon) FROM affected_ways x "
+                    "JOIN way_nodes w ON w.way_id=x.way_id JOIN nodes n ON n.node_id=w.node_id WHERE %s GROUP BY x.way_id", cond);
+                break;
+            default:
+                // the member nodes and the nodes of the member ways of the relation and of all its member relations
+                removed = exec_update(h, sqlite3_mprintf("DELETE FROM %s WHERE relation_id IN (SELECT relation_id FROM affected_relations);", r->table));
+                select = sqlite3_mprintf("WITH RECURSIVE sub(root,relation_id) AS (SELECT relation_id,relation_id FROM affected_relations "
+                    "UNION SELECT sub.root,m.ref FROM sub JOIN %s m ON m.relation_id=sub.relation_id AND m.type=%s) "
+                    "SELECT x.relation_id,min(x.lat),max(x.lat),min(x.lon),max(x.lon) FROM ("
+                    "SELECT s.root AS relation_id,n.lat,n.lon FROM sub s JOIN %s m ON m.relation_id=s.relation_id "
+                    "JOIN nodes n ON m.type=%s AND n.node_id=m.ref UNION ALL "
+                    "SELECT s.root AS relation_id,n.lat,n.lon FROM sub s JOIN %s m ON m.relation_id=s.relation_id "
+                    "JOIN way_nodes w ON m.type=%s AND w.way_id=m.ref JOIN nodes n ON n.node_id=w.node_id"
+                    ") x WHERE %s GROUP BY x.relation_id", members, rel_type, members, node_type, members, way_type, cond);
+                break;
+        }
+        added = exec_update(h, sqlite3_mprintf("INSERT INTO %s (%s_id,min_lat,max_lat,min_lon,max_lon) %z;",
+            r->table, member_type(r->type), select));
+        r->rows += added;
+        fprintf(stderr, "%-24s %9d boxes removed, %9d written\n", r->table, removed, added);
+        sqlite3_free(cond);
+    }
+}
+
+/* apply the change file f to the database at path */
+static void update_database( FILE *f, const char *path ) {
+    O5mreader* reader;
+    O5mreaderEntity *entity;
+    O5mreaderIterateRet ret;
+    Batch *b = batch_new();
+    PairCache *cache = dict_encoding ? pair_cache_new() : NULL;
+    sqlite3_stmt *mark[3], *del[W_COUNT], *del_node_ways = NULL;
+    uint64_t modified[3] = { 0, 0, 0 }, deleted[3] = { 0, 0, 0 };
+    double t = now();
+    int i, k, has_node_ways;
+
+    check_rc( sqlite3_open_v2(path, &db, SQLITE_OPEN_READWRITE, NULL) );
+    if( memory_plan.total ) apply_memory(db, 0);
+    check_rc( waynodes_register(db) );
+    for( i=0; i<W_COUNT; i++ ) {
+        if( writers[i].insert==NULL || db_has_table(db, writers[i].name) ) continue;
+        fprintf(stderr, "%s has no table %s, the layout options have to be the ones of the import\n", path, writers[i].name);
+        sqlite3_close(db);
+        exit(1);
+    }
+    has_node_ways = packed_ways && db_has_table(db, "node_ways");
+    for( i=k=0; i<n_rtrees; i++ ) {
+        if( db_has_table(db, rtrees[i].table) ) rtrees[k++] = rtrees[i];
+        else fprintf(stderr, "no R*Tree table %s, not updated\n", rtrees[i].table);
+    }
+    n_rtrees = k;
+    store_locations = store_way_boxes = 0;
+    if( dict_encoding ) {
+        load_dict(db, &dict_keys, "keys", "key");
+        load_dict(db, &dict_values, "tag_values", "value");
+        load_dict(db, &dict_roles, "roles", "role");
+    }
+
+    check_rc( sqlite3_exec(db,"BEGIN TRANSACTION",NULL,NULL,NULL) );
+    check_rc( sqlite3_exec(db,
+        "CREATE TEMP TABLE changed_nodes (node_id INTEGER PRIMARY KEY);\n"
+        "CREATE TEMP TABLE changed_ways (way_id INTEGER PRIMARY KEY);\n"
+        "CREATE TEMP TABLE changed_relations (relation_id INTEGER PRIMARY KEY);",NULL,NULL,NULL) );
+    for( k=0; k<3; k++ )
+        mark[k] = prepare_update(db, sqlite3_mprintf("INSERT OR IGNORE INTO changed_%ss VALUES (?1);", member_type(entity_types[k])));
+    for( i=0; i<W_COUNT; i++ )
+        del[i] = writers[i].insert==NULL ? NULL : prepare_update(db, sqlite3_mprintf("DELETE FROM %s WHERE %s=?1;", writers[i].name, update_ids[i]));
+    if( has_node_ways )
+        del_node_ways = prepare_update(db, sqlite3_mprintf("%s", "DELETE FROM node_ways WHERE way_id=?1 AND node_id IN "
+            "(SELECT node_id FROM ways,way_nodes_unpack(ways.nodes) WHERE ways.way_id=?1);"));
+    prepare_writers(db, writers, 0, W_COUNT);
+
+    fprintf(stderr, "apply changes...\n");
+    if( o5mreader_open(&reader,f)==O5MREADER_RET_ERR ) {
+        fprintf(stderr, "o5m read error: %s\n", reader ? o5mreader_strerror(reader->errCode) : "out of memory");
+        sqlite3_close(db);
+        exit(1);
+    }
+    while( (ret = o5mreader_readEntity(reader, &entity)) == O5MREADER_ITERATE_RET_NEXT ) {
+        k = entity->ds.type-O5MREADER_DS_NODE;
+        if( k<0 || k>2 ) continue;
+        sqlite3_bind_int64(mark[k],1,entity->ds.id);
+        step_stmt(mark[k], "could not mark changed id.\n", -15);
+        // the id was changed before: its rows have to be written to be replaced
+        if( sqlite3_changes(db)==0 ) {
+            b->pos = o5mreader_tell(reader);
+            write_batch(writers, b);
+            batch_clear(b);
+        }
+        if( k==1 && del_node_ways ) {
+            sqlite3_bind_int64(del_node_ways,1,entity->ds.id);
+            step_stmt(del_node_ways, "could not delete node ways.\n", -15);
+        }
+        for( i=0; i<W_COUNT; i++ ) {
+            if( update_types[i]!=k || del[i]==NULL ) continue;
+            sqlite3_bind_int64(del[i],1,entity->ds.id);
+            step_stmt(del[i], "could not delete changed rows.\n", -15);
+        }
+        if( entity->ds.isEmpty ) {
+            deleted[k]++;
+            continue;
+        }
+        modified[k]++;
+        batch_entity(b, entity, cache);
+        if( b->rows>=batch_rows ) {
+            b->pos = o5mreader_tell(reader);
+            write_batch(writers, b);
+            batch_clear(b);
+        }
+    }
+    if( ret==O5MREADER_ITERATE_RET_ERR ) {
+        fprintf(stderr, "o5m read error: %s\n", o5mreader_strerror(reader->errCode));
+        sqlite3_close(db);
+        exit(1);
+    }
+    b->pos = o5mreader_tell(reader);
+    write_batch(writers, b);
+    o5mreader_close(reader);
+    batch_free(b);
+    free(cache);
+    finalize_writers(writers);
+    for( k=0; k<3; k++ ) sqlite3_finalize(mark[k]);
+    for( i=0; i<W_COUNT; i++ ) sqlite3_finalize(del[i]);
+    sqlite3_finalize(del_node_ways);
+
+    // new dictionary entries are appended, the tag views need them for the R*Trees
+    if( dict_encoding ) {
+        write_dict(db, &dict_keys, "keys");
+        write_dict(db, &dict_values, "tag_values");
+        write_dict(db, &dict_roles, "roles");
+    }
+    if( has_node_ways )
+        exec_update(db, sqlite3_mprintf("%s", "INSERT OR IGNORE INTO node_ways SELECT node_id,ways.way_id "
+            "FROM changed_ways,ways,way_nodes_unpack(ways.nodes) WHERE ways.way_id=changed_ways.way_id;"));
+    if( n_rtrees ) {
+        fprintf(stderr, "update R*Tree indexes...\n");
+        update_rtrees(db, has_node_ways);
+    }
+    check_rc( sqlite3_exec(db,"COMMIT",NULL,NULL,NULL) );
+    print_dropped();
+    if( insert_stats ) print_insert_stats();
+    cache_add(db);
+
+    fprintf(stderr, "\n%-10s %12s %12s\n", "", "modified", "deleted");
+    for( k=0; k<3; k++ )
+        fprintf(stderr, "%-10s %12llu %12llu\n", k==0 ? "nodes" : k==1 ? "ways" : "relations",
+            (unsigned long long)modified[k], (unsigned long long)deleted[k]);
+    fprintf(stderr, "applied in %.2fs\n", now()-t);
+    sqlite3_close(db);
+}
+
+/* the options that shape the database, --resume has to be given the same ones */
+static char *import_options( int n, char *arg[] ) {
+    char *options = sqlite3_mprintf("%s", "");
+    int i;
+
+    for( i=1; i<n; i++ ) {
+        if( strncmp(arg[i],"--progress=",11)==0 || strncmp(arg[i],"--stats=",8)==0 || strcmp(arg[i],"--bench")==0 ||
+            strcmp(arg[i],"--insert-stats")==0 || strncmp(arg[i],"--checkpoint=",13)==0 || strcmp(arg[i],"--resume")==0 )
+            continue;
+        options = sqlite3_mprintf("%z%s%s", options, *options ? " " : "", arg[i]);
+    }
+    return options;
+}
+
+/* a coordinate of the nodes table in 1E-7 degrees */
+static int32_t column_coord( sqlite3_stmt *stmt, int col ) {
+    double v;
+    if( fixed_coords ) return sqlite3_column_int(stmt, col);
+    v = sqlite3_column_double(stmt, col)*1E7;
+    return (int32_t)(v<0 ? v-0.5 : v+0.5);
+}
+
+/* --resume: the node locations, way and relation boxes of the R*Trees from the rows written before the checkpoint */
+static void resume_locations( void ) {
+    sqlite3_stmt *stmt;
+    BoxEntry e, member;
+    int32_t lat, lon;
+    int64_t i;
+    int found = 0, in_relation = 0, k;
+    char *sql;
+
+    if( store_locations ) {
+        check_rc( sqlite3_prepare_v2(db, fixed_coords ? "SELECT node_id,lat,lon FROM nodes_fixed;" :
+            "SELECT node_id,lat,lon FROM nodes;", -1, &stmt, NULL) );
+        while( sqlite3_step(stmt)==SQLITE_ROW )
+            loc_put(&locations, sqlite3_column_int64(stmt,0), column_coord(stmt,1), column_coord(stmt,2));
+        sqlite3_finalize(stmt);
+    }
+    if( !store_way_boxes ) return;
+    check_rc( sqlite3_prepare_v2(db, "SELECT way_id,node_id FROM way_nodes ORDER BY way_id;", -1, &stmt, NULL) );
+    while( sqlite3_step(stmt)==SQLITE_ROW ) {
+        if( found && sqlite3_column_int64(stmt,0)!=e.id ) {
+            box_put(&way_boxes, &e);
+            found = 0;
+        }
+        e.id = sqlite3_column_int64(stmt,0);
+        if( !loc_get(&locations, sqlite3_column_int64(stmt,1), &lat, &lon) ) continue;
+        if( !found || lat<e.min_lat ) e.min_lat = lat;
+        if( !found || lat>e.max_lat ) e.max_lat = lat;
+        if( !found || lon<e.min_lon ) e.min_lon = lon;
+        if( !found || lon>e.max_lon ) e.max_lon = lon;
+        found = 1;
+    }
+    if( found ) box_put(&way_boxes, &e);
+    sqlite3_finalize(stmt);
+
+    // relations with the boxes of their node and way members, member relations are joined at the end
+    sql = sqlite3_mprintf("SELECT relation_id,CASE type WHEN %s THEN %d WHEN %s THEN %d ELSE %d END,ref FROM %s ORDER BY relation_id;",
+        dict_encoding ? "0" : "'node'", O5MREADER_DS_NODE, dict_encoding ? "1" : "'way'", O5MREADER_DS_WAY, O5MREADER_DS_REL,
+        writers[W_REL_MEMBERS].name);
+    check_rc( sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) );
+    sqlite3_free(sql);
+    while( sqlite3_step(stmt)==SQLITE_ROW ) {
+        if( in_relation && sqlite3_column_int64(stmt,0)!=e.id ) {
+            relation_put(&relation_boxes, &e, 0, found);
+            in_relation = 0;
+        }
+        if( !in_relation ) {
+            e.id = sqlite3_column_int64(stmt,0);
+            found = 0;
+            in_relation = 1;
+        }
+        switch( sqlite3_column_int(stmt,1) ) {
+            case O5MREADER_DS_NODE:
+                if( !loc_get(&locations, sqlite3_column_int64(stmt,2), &lat, &lon) ) continue;
+                member.min_lat = member.max_lat = lat;
+                member.min_lon = member.max_lon = lon;
+                break;
+            case O5MREADER_DS_WAY:
+                if( !box_get(&way_boxes, sqlite3_column_int64(stmt,2), &member) ) continue;
+                break;
+            default:
+                relation_edge(&relation_boxes, e.id, sqlite3_column_int64(stmt,2));
+                continue;
+        }
+        if( !found || member.min_lat<e.min_lat ) e.min_lat = member.min_lat;
+        if( !found || member.max_lat>e.max_lat ) e.max_lat = member.max_lat;
+        if( !found || member.min_lon<e.min_lon ) e.min_lon = member.min_lon;
+        if( !found || member.max_lon>e.max_lon ) e.max_lon = member.max_lon;
+        found = 1;
+    }
+    if( in_relation ) relation_put(&relation_boxes, &e, 0, found);
+    sqlite3_finalize(stmt);
+    for( k=0; k<n_rtrees; k++ ) {
+        if( rtrees[k].type!=O5MREADER_DS_REL ) continue;
+        if( strcmp(rtrees[k].key,"*")==0 ) {
+            for( i=0; i<(int64_t)relation_boxes.n; i++ ) relation_boxes.boxes[i].mask |= 1u<<k;
+            continue;
+        }
+        sql = rtrees[k].value ?
+            sqlite3_mprintf("SELECT relation_id FROM relation_tags WHERE key=%Q AND value=%Q;", rtrees[k].key, rtrees[k].value) :
+            sqlite3_mprintf("SELECT relation_id FROM relation_tags WHERE key=%Q;", rtrees[k].key);
+        check_rc( sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) );
+        sqlite3_free(sql);
+        while( sqlite3_step(stmt)==SQLITE_ROW )
+            if( (i = relation_find(&relation_boxes, sqlite3_column_int64(stmt,0)))>=0 ) relation_boxes.boxes[i].mask |= 1u<<k;
+        sqlite3_finalize(stmt);
+    }
+}
+
+/*
+** --resume: read the checkpoint of the output database. Returns 1 when
+** decoding continues at resume_offset, with the dictionaries, the node
+** locations, way and relation boxes rebuilt from the tables, 0 when only
+** statements of the index phase are left.
+*/
+static int resume_load( const char *path, const char *options ) {
+    sqlite3_stmt *stmt;
+    const char *key, *text;
+    int importing = 0;
+
+    if( !db_has_table(db, "o5m2sqlite_checkpoint") ) {
+        fprintf(stderr, "%s has no checkpoint to resume from\n", path);
         sqlite3_close(db);
         exit(1);
     }
+    check_rc( sqlite3_prepare_v2(db,"SELECT key,value FROM o5m2sqlite_checkpoint;",-1,&stmt,NULL) );
+    while( sqlite3_step(stmt)==SQLITE_ROW ) {
+        key = (const char *)sqlite3_column_text(stmt,0);
+        text = (const char *)sqlite3_column_text(stmt,1);
+        if( strcmp(key,"options")==0 && strcmp(text,options)!=0 ) {
+            fprintf(stderr, "%s was imported with the options \"%s\", --resume needs the same ones\n", path, text);
+            sqlite3_close(db);
+            exit(1);
+        }
+        else if( strcmp(key,"phase")==0 ) importing = strcmp(text,"import")==0;
+        else if( strcmp(key,"offset")==0 ) resume_offset = sqlite3_column_int64(stmt,1);
+        else if( strcmp(key,"statements")==0 ) statements_done = sqlite3_column_int64(stmt,1);
+        else if( strcmp(key,"nodes")==0 ) counts.entities[0] = sqlite3_column_int64(stmt,1);
+        else if( strcmp(key,"ways")==0 ) counts.entities[1] = sqlite3_column_int64(stmt,1);
+        else if( strcmp(key,"relations")==0 ) counts.entities[2] = sqlite3_column_int64(stmt,1);
+        else if( strcmp(key,"tags")==0 ) counts.tags = sqlite3_column_int64(stmt,1);
+        else if( strcmp(key,"way_nodes")==0 ) counts.nds = sqlite3_column_int64(stmt,1);
+        else if( strcmp(key,"members")==0 ) counts.members = sqlite3_column_int64(stmt,1);
+        else if( strcmp(key,"reader")==0 ) {
+            resume_state_size = sqlite3_column_bytes(stmt,1);
+            if( (resume_state = malloc(resume_state_size))==NULL ) {
+                fprintf(stderr, "out of memory\n");
+                exit(1);
+            }
+            memcpy(resume_state, sqlite3_column_blob(stmt,1), resume_state_size);
+        }
+    }
+    sqlite3_finalize(stmt);
+    counts.pos = resume_offset;
+    counts_printed = counts;
+    if( !importing ) {
+        fprintf(stderr, "resume the index phase after %llu statements...\n", (unsigned long long)statements_done);
+        return 0;
+    }
+    fprintf(stderr, "resume at offset %llu after %llu nodes, %llu ways and %llu relations...\n",
+        (unsigned long long)resume_offset, (unsigned long long)counts.entities[0],
+        (unsigned long long)counts.entities[1], (unsigned long long)counts.entities[2]);
+    if( dict_encoding ) {
+        load_dict(db, &dict_keys, "keys", "key");
+        load_dict(db, &dict_values, "tag_values", "value");
+        load_dict(db, &dict_roles, "roles", "role");
+    }
+    resume_locations();
+    return 1;
 }
 
 int main(int narg, char * arg[])
 {
-    // o5m reader
-    O5mreader* reader;
-    O5mreaderDataset ds;
-    O5mreaderIterateRet ret, ret2;
-    char *key, *val;
-    uint64_t nodeId;
-    uint64_t refId;
-    uint8_t type;
-    char *role;
     FILE * f;
-    uint64_t local_order;
-    uint64_t cnt_ds;
-    
-    // sqlite
-    sqlite3_stmt *stmt_node, *stmt_node_tag, *stmt_way_tag, *stmt_way_node, *stmt_rel_tag, *stmt_rel_member;
-    
-    if((narg==2) && strcmp(arg[1],"--schema")==0) {
-        fprintf(stderr, "\n%s\n%s\n\n", O5M2SQLITE_CREATE_TABLES, O5M2SQLITE_CREATE_INDEXES);
+    int threads = 1;
+    int pipeline = 0;
+    int show_schema = 0;
+    const char *rtree_list = "way:highway";
+    int dry_run = 0;
+    int importing = 1;
+    char *options;
+    StageClock clock;
+    double t_start, t_import;
+    int i = 1, j;
+
+    while( i<narg && strncmp(arg[i],"--",2)==0 ) {
+        if( strcmp(arg[i],"--schema")==0 ) {
+            show_schema = 1;
+        }
+        else if( strcmp(arg[i],"--schema=default")==0 ) {
+            clustered = 0;
+        }
+        else if( strcmp(arg[i],"--schema=clustered")==0 ) {
+            clustered = 1;
+        }
+        else if( strcmp(arg[i],"--dict")==0 ) {
+            dict_encoding = 1;
+        }
+        else if( strcmp(arg[i],"--coords=real")==0 ) {
+            fixed_coords = 0;
+        }
+        else if( strcmp(arg[i],"--coords=fixed")==0 ) {
+            fixed_coords = 1;
+        }
+        else if( strcmp(arg[i],"--ways=rows")==0 ) {
+            packed_ways = 0;
+        }
+        else if( strcmp(arg[i],"--ways=packed")==0 ) {
+            packed_ways = 1;
+        }
+        else if( strcmp(arg[i],"--node-ways")==0 ) {
+            node_ways = 1;
+        }
+        else if( strcmp(arg[i],"--geometry=none")==0 ) {
+            way_geometry = GEOM_NONE;
+        }
+        else if( strcmp(arg[i],"--geometry=wkb")==0 ) {
+            way_geometry = GEOM_WKB;
+        }
+        else if( strcmp(arg[i],"--geometry=spatialite")==0 ) {
+            way_geometry = GEOM_SPATIALITE;
+        }
+        else if( strncmp(arg[i],"--locations=",12)==0 ) {
+            for( j=LOC_NONE; j<=LOC_DENSE; j++ ) if( strcmp(arg[i]+12,loc_mode_name(j))==0 ) break;
+            if( j>LOC_DENSE ) {
+                fprintf(stderr, O5M2SQLITE_HELP );
+                return(1);
+            }
+            locations.mode = j;
+        }
+        else if( strncmp(arg[i],"--rtree=",8)==0 ) {
+            rtree_list = arg[i]+8;
+        }
+        else if( strncmp(arg[i],"--types=",8)==0 ) {
+            if( !types_parse(arg[i]+8) ) {
+                fprintf(stderr, O5M2SQLITE_HELP );
+                return(1);
+            }
+        }
+        else if( strncmp(arg[i],"--keep=",7)==0 ) {
+            if( !keep_parse(arg[i]+7) ) {
+                fprintf(stderr, O5M2SQLITE_HELP );
+                return(1);
+            }
+        }
+        else if( strncmp(arg[i],"--bbox=",7)==0 ) {
+            if( !bbox_parse(arg[i]+7) ) {
+                fprintf(stderr, O5M2SQLITE_HELP );
+                return(1);
+            }
+        }
+        else if( strncmp(arg[i],"--polygon=",10)==0 ) {
+            if( !polygon_parse(arg[i]+10) ) {
+                fprintf(stderr, "can't read polygon file %s\n", arg[i]+10);
+                return(1);
+            }
+        }
+        else if( strcmp(arg[i],"--nodes=all")==0 ) {
+            referenced_nodes = 0;
+        }
+        else if( strcmp(arg[i],"--nodes=referenced")==0 ) {
+            referenced_nodes = 1;
+        }
+        else if( strcmp(arg[i],"--dry-run")==0 ) {
+            dry_run = 1;
+        }
+        else if( strcmp(arg[i],"--update")==0 ) {
+            updating = 1;
+        }
+        else if( strcmp(arg[i],"--bench")==0 ) {
+            bench = 1;
+        }
+        else if( strncmp(arg[i],"--progress=",11)==0 && atof(arg[i]+11)>=0 ) {
+            progress_interval = atof(arg[i]+11);
+        }
+        else if( strncmp(arg[i],"--stats=",8)==0 && arg[i][8] ) {
+            stats_path = arg[i]+8;
+        }
+        else if( strncmp(arg[i],"--threads=",10)==0 && atoi(arg[i]+10)>0 ) {
+            threads = atoi(arg[i]+10);
+        }
+        else if( strcmp(arg[i],"--pipeline")==0 ) {
+            pipeline = 1;
+        }
+        else if( strncmp(arg[i],"--queue-depth=",14)==0 && atoi(arg[i]+14)>0 ) {
+            queue_depth = atoi(arg[i]+14);
+            queue_depth_set = 1;
+        }
+        else if( strncmp(arg[i],"--batch-size=",13)==0 && atoi(arg[i]+13)>0 ) {
+            batch_rows = atoi(arg[i]+13);
+        }
+        else if( strncmp(arg[i],"--insert-rows=",14)==0 && atoi(arg[i]+14)>0 ) {
+            insert_rows = atoi(arg[i]+14);
+        }
+        else if( strcmp(arg[i],"--insert-stats")==0 ) {
+            insert_stats = 1;
+        }
+        else if( strcmp(arg[i],"--shards")==0 ) {
+            sharded = 1;
+        }
+        else if( strncmp(arg[i],"--sort-memory=",14)==0 && atoi(arg[i]+14)>0 ) {
+            sort_memory = (size_t)atoi(arg[i]+14)*1024*1024;
+        }
+        else if( strncmp(arg[i],"--memory=",9)==0 && atoi(arg[i]+9)>0 ) {
+            memory_plan.total = (uint64_t)atoi(arg[i]+9)*1024*1024;
+        }
+        else if( strncmp(arg[i],"--checkpoint=",13)==0 && atoll(arg[i]+13)>0 ) {
+            checkpoint_interval = atoll(arg[i]+13);
+        }
+        else if( strcmp(arg[i],"--resume")==0 ) {
+            resuming = 1;
+        }
+        else {
+            fprintf(stderr, O5M2SQLITE_HELP );
+            return(1);
+        }
+        i++;
+    }
+
+    if( node_ways && !packed_ways ) {
+        fprintf(stderr, "--node-ways needs --ways=packed\n");
+        return(1);
+    }
+    if( way_geometry && locations.mode==LOC_NONE ) {
+        fprintf(stderr, "--geometry needs a node location store, not --locations=none\n");
+        return(1);
+    }
+    if( way_geometry && updating ) {
+        fprintf(stderr, "--geometry is built while importing only, --update can't change it\n");
+        return(1);
+    }
+    // ways and relations are tested against the nodes in the area decoded before them
+    if( area_filter && threads>1 ) {
+        fprintf(stderr, "--bbox and --polygon need a single decoder, not --threads\n");
+        return(1);
+    }
+    filtering = n_keeps>0 || import_types!=7 || area_filter || referenced_nodes;
+    if( updating && (filtering || threads>1 || pipeline || sharded || sort_memory) ) {
+        fprintf(stderr, "--update applies the whole change file on one thread: no filters, --threads, --pipeline, --shards or --sort-memory\n");
+        return(1);
+    }
+
+    if( resuming && !checkpoint_interval ) checkpoint_interval = O5M2SQLITE_CHECKPOINT;
+    if( checkpoint_interval && (threads>1 || pipeline || sharded || sort_memory || area_filter || updating || dry_run) ) {
+        fprintf(stderr, "--checkpoint and --resume decode on one thread: no --threads, --pipeline, --shards, --sort-memory, --bbox, --polygon, --update or --dry-run\n");
+        return(1);
+    }
+
+    if( bench ) bench_args = bench_quote(narg, arg);
+
+    if( dry_run ) {
+        if( narg-i<1 ) {
+            fprintf(stderr, O5M2SQLITE_HELP );
+            return(1);
+        }
+        f = input_open(arg[i]);
+        if( f==NULL ) {
+            fprintf(stderr, "Can't open o5m file %s\n", arg[i]);
+            return(1);
+        }
+        check_seekable(arg[i]);
+        if( referenced_nodes ) mark_referenced(f);
+        import_dry_run(f);
+        input_close(f);
+        return 0;
+    }
+
+    if( *rtree_list && !rtree_parse(rtree_list) ) {
+        fprintf(stderr, O5M2SQLITE_HELP );
+        return(1);
+    }
+    schema_build();
+    if( show_schema ) {
+        print_schema();
         return(0);
     }
-    
-    if(narg<3) {
+
+    if( narg-i<2 ) {
         fprintf(stderr, O5M2SQLITE_HELP );
         return(1);
     }
+
+    if( dict_encoding ) {
+        dict_init(&dict_keys);
+        dict_init(&dict_values);
+        dict_init(&dict_roles);
+    }
     
     // open o5m file
-    f = fopen(arg[1],"rb");
+    f = input_open(arg[i]);
     if( f==NULL ) {
-        fprintf(stderr, "Can't open o5m file %s\n", arg[1]);
+        fprintf(stderr, "Can't open o5m file %s\n", arg[i]);
         return(1);
     }
+    check_seekable(arg[i]);
+    if( !input_seekable && threads>1 ) {
+        fprintf(stderr, "%s can't be split into chunks, decoding on one thread\n", arg[i]);
+        threads = 1;
+        pipeline = 1;
+    }
+    if( memory_plan.total ) plan_memory(threads, threads>1 || pipeline || sharded);
+    t_start = import_start = progress_last = now();
+    if( updating ) {
+        update_database(f, arg[i+1]);
+        input_close(f);
+        print_stages();
+        print_memory();
+        if( stats_path ) write_stats(stats_path, arg[i], now()-t_start);
+        return 0;
+    }
+    if( referenced_nodes ) {
+        fprintf(stderr, "mark referenced nodes...\n");
+        mark_referenced(f);
+    }
     
+    if( sharded ) {
+        shards_open(arg[i+1], threads*queue_depth);
+        if( threads>1 ) import_parallel(f, arg[i], threads);
+        else import_threaded(f, arg[i], NULL, 1, 1);
+        input_close(f);
+        print_filter_stats();
+        print_locations();
+        resolve_relation_boxes();
+        stage_start(&clock);
+        shards_combine();
+        stage_end("combine shards", &clock);
+        check_rc( sqlite3_exec(db,"BEGIN TRANSACTION",NULL,NULL,NULL) );
+        rtree_flush(db, 0);
+        stage_start(&clock);
+        check_rc( sqlite3_exec(db,"COMMIT",NULL,NULL,NULL) );
+        stage_end("commit", &clock);
+        t_import = now();
+        write_dicts(db);
+        print_dropped();
+        if( insert_stats ) print_insert_stats();
+        fprintf(stderr,"\ncreate indexes...\n");
+        exec_stages(db, schema.finish);
+        cache_add(db);
+        sqlite3_close(db);
+        print_stages();
+        print_memory();
+        if( stats_path ) write_stats(stats_path, arg[i], now()-t_start);
+        if( bench ) print_bench("import", input_size, counts.entities[0]+counts.entities[1]+counts.entities[2], -1, t_import-t_start, now()-t_import);
+        return 0;
+    }
+
     // open sqlite database
-    check_rc( sqlite3_open(arg[2], &db) );
-    
-    check_rc( sqlite3_exec(db,"PRAGMA synchronous = OFF",NULL,NULL,NULL) );
-    check_rc( sqlite3_exec(db,"PRAGMA journal_mode = MEMORY",NULL,NULL,NULL) );
+    db = open_db(arg[i+1]);
+    // a killed import has to leave the database at its last checkpoint
+    if( checkpoint_interval ) check_rc( sqlite3_exec(db,"PRAGMA journal_mode = TRUNCATE",NULL,NULL,NULL) );
     
     check_rc( sqlite3_exec(db,"BEGIN TRANSACTION",NULL,NULL,NULL) );
     
-    // create tables
-    fprintf(stderr,"create tables...\n");
-    check_rc( sqlite3_exec(db,O5M2SQLITE_CREATE_TABLES,NULL,NULL,NULL) );
+    options = import_options(i, arg);
+    if( resuming ) importing = resume_load(arg[i+1], options);
+    else {
+        // create tables
+        fprintf(stderr,"create tables...\n");
+        for( j=0; j<3; j++ ) check_rc( sqlite3_exec(db,schema.tables[j],NULL,NULL,NULL) );
+        if( checkpoint_interval ) {
+            check_rc( sqlite3_exec(db,"CREATE TABLE o5m2sqlite_checkpoint (key TEXT PRIMARY KEY,value);",NULL,NULL,NULL) );
+            if( dict_encoding ) check_rc( sqlite3_exec(db,schema.dict_tables,NULL,NULL,NULL) );
+            checkpoint_put_text(db, "options", options);
+        }
+    }
+    sqlite3_free(options);
     
     // prepare statements
-    check_rc( sqlite3_prepare_v2(db,ins_node,-1,&stmt_node,NULL) );
-    check_rc( sqlite3_prepare_v2(db,ins_node_tag,-1,&stmt_node_tag,NULL) );
-    check_rc( sqlite3_prepare_v2(db,ins_way_tag,-1,&stmt_way_tag,NULL) );
-    check_rc( sqlite3_prepare_v2(db,ins_way_node,-1,&stmt_way_node,NULL) );
-    check_rc( sqlite3_prepare_v2(db,ins_rel_tag,-1,&stmt_rel_tag,NULL) );
-    check_rc( sqlite3_prepare_v2(db,ins_rel_member,-1,&stmt_rel_member,NULL) );
+    prepare_writers(db, writers, 0, W_COUNT);
     
-    o5mreader_open(&reader,f);
-    
-    // iterate over the o5m file entries
-    while( (ret = o5mreader_iterateDataSet(reader, &ds)) == O5MREADER_ITERATE_RET_NEXT ) {
-        switch ( ds.type ) {
-            // Data set is node
-            case O5MREADER_DS_NODE:
-                // Could do something with ds.id, ds.lon, ds.lat here, lon and lat are ints in 1E+7 * degree units
-                sqlite3_bind_int64(stmt_node,1,ds.id);
-                sqlite3_bind_double(stmt_node,2,ds.lat/1E7);
-                sqlite3_bind_double(stmt_node,3,ds.lon/1E7);
-                if(sqlite3_step(stmt_node)==SQLITE_DONE) sqlite3_reset(stmt_node);
-                else {
-                    printf("could not insert node.\n");
-                    sqlite3_close(db);
-                    return -6;
-                }
-                
-                sqlite3_bind_int64(stmt_node_tag,1,ds.id);
-                // Node tags iteration
-                while ( (ret2 = o5mreader_iterateTags(reader,&key,&val)) == O5MREADER_ITERATE_RET_NEXT  ) {
-                    // Could do something with tag key and val
-                    sqlite3_bind_text(stmt_node_tag,2,key,-1,NULL);
-                    sqlite3_bind_text(stmt_node_tag,3,val,-1,NULL);
-                    if(sqlite3_step(stmt_node_tag)==SQLITE_DONE) sqlite3_reset(stmt_node_tag);
-                    else {
-                        printf("could not insert node tag.\n");
-                        sqlite3_close(db);
-                        return -7;
-                    }
-                }
-                break;
-                
-            // Data set is way
-            case O5MREADER_DS_WAY:
-                // Could do something with ds.id
-                
-                sqlite3_bind_int64(stmt_way_node,1,ds.id);
-                // Nodes iteration
-                local_order=0;
-                while ( (ret2 = o5mreader_iterateNds(reader,&nodeId)) == O5MREADER_ITERATE_RET_NEXT  ) {
-                    // Could do something with nodeId
-                    local_order++;
-                    sqlite3_bind_int(stmt_way_node,2,local_order);
-                    sqlite3_bind_int64(stmt_way_node,3,nodeId);
-                    if(sqlite3_step(stmt_way_node)==SQLITE_DONE) sqlite3_reset(stmt_way_node);
-                    else {
-                        printf("could not insert way node.\n");
-                        sqlite3_close(db);
-                        return -9;
-                    }
-                }
-                
-                sqlite3_bind_int64(stmt_way_tag,1,ds.id);
-                // Way tags iteration
-                while ( (ret2 = o5mreader_iterateTags(reader,&key,&val)) == O5MREADER_ITERATE_RET_NEXT  ) {
-                    // Could do something with tag key and val
-                    sqlite3_bind_text(stmt_way_tag,2,key,-1,NULL);
-                    sqlite3_bind_text(stmt_way_tag,3,val,-1,NULL);
-                    if(sqlite3_step(stmt_way_tag)==SQLITE_DONE) sqlite3_reset(stmt_way_tag);
-                    else {
-                        printf("could not insert way tag.\n");
-                        sqlite3_close(db);
-                        return -10;
-                    }
-                }
-                break;
-                
-            // Data set is relation
-            case O5MREADER_DS_REL:
-                // Could do something with ds.id
-                
-                sqlite3_bind_int64(stmt_rel_member,1,ds.id);
-                // Refs iteration
-                while ( (ret2 = o5mreader_iterateRefs(reader,&refId,&type,&role)) == O5MREADER_ITERATE_RET_NEXT  ) {
-                    // Could do something with refId (way or node or rel id depends on type), type and role
-                    
-                    switch(type) {
-                        case O5MREADER_DS_NODE:
-                            sqlite3_bind_text(stmt_rel_member,2,"node",-1,NULL);
-                            break;
-                        case O5MREADER_DS_WAY:
-                            sqlite3_bind_text(stmt_rel_member,2,"way",-1,NULL);
-                            break;
-                        case O5MREADER_DS_REL:
-                            sqlite3_bind_text(stmt_rel_member,2,"relation",-1,NULL);
-                            break;
-                        default:
-                            sqlite3_bind_text(stmt_rel_member,2,"",-1,NULL);
-                            break;
-                    }
-                    sqlite3_bind_int64(stmt_rel_member,3,refId);
-                    sqlite3_bind_text(stmt_rel_member,4,role,-1,NULL);
-                    
-                    if(sqlite3_step(stmt_rel_member)==SQLITE_DONE) sqlite3_reset(stmt_rel_member);
-                    else {
-                        printf("could not insert rel member.\n");
-                        sqlite3_close(db);
-                        return -12;
-                    }
-                }
-                
-                sqlite3_bind_int64(stmt_rel_tag,1,ds.id);
-                // Relation tags iteration
-                while ( (ret2 = o5mreader_iterateTags(reader,&key,&val)) == O5MREADER_ITERATE_RET_NEXT  ) {
-                    // Could do something with tag key and val
-                    sqlite3_bind_text(stmt_rel_tag,2,key,-1,NULL);
-                    sqlite3_bind_text(stmt_rel_tag,3,val,-1,NULL);
-                    
-                    if(sqlite3_step(stmt_rel_tag)==SQLITE_DONE) sqlite3_reset(stmt_rel_tag);
-                    else {
-                        printf("could not insert rel tag.\n");
-                        sqlite3_close(db);
-                        return -13;
-                    }
-                }
-                break;
-        } // end of switch-case
-        
-        cnt_ds++;
-        if( cnt_ds>1000000 ) {
-            fprintf(stderr,"o");
-            cnt_ds = 0;
-        }
-    } // end of o5m elements iteration
+    if( threads>1 ) import_parallel(f, arg[i], threads);
+    else if( pipeline ) import_threaded(f, arg[i], NULL, 1, 1);
+    else if( importing ) import_sequential(f);
     
     // close o5m file
-    fclose(f);
+    input_close(f);
+    print_filter_stats();
+    print_locations();
+    resolve_relation_boxes();
+    rtree_flush(db, 0);
+
+    load_sorted(db, writers, 0, W_COUNT);
+    finalize_writers(writers);
+    print_dropped();
+    if( insert_stats ) print_insert_stats();
+    if( checkpoint_interval && importing ) checkpoint_save(NULL, "indexes");
 
     // finish transaction
+    stage_start(&clock);
     check_rc( sqlite3_exec(db,"COMMIT",NULL,NULL,NULL) );
+    stage_end("commit", &clock);
+    t_import = now();
     
+    write_dicts(db);
+
     // create sqlite indexes
     fprintf(stderr,"\ncreate indexes...\n");
-    check_rc( sqlite3_exec(db,O5M2SQLITE_CREATE_INDEXES,NULL,NULL,NULL) );
+    for( j=0; j<3; j++ ) create_indexes(db, schema.indexes[j]);
+    exec_stages(db, schema.finish);
+    if( checkpoint_interval ) {
+        check_rc( sqlite3_exec(db,"DROP TABLE o5m2sqlite_checkpoint",NULL,NULL,NULL) );
+        check_rc( sqlite3_exec(db,"PRAGMA journal_mode = DELETE",NULL,NULL,NULL) );
+    }
     
     // close sqlite database
+    cache_add(db);
     sqlite3_close(db);
+    print_stages();
+    print_memory();
+    if( stats_path ) write_stats(stats_path, arg[i], now()-t_start);
+    if( bench ) print_bench("import", input_size, counts.entities[0]+counts.entities[1]+counts.entities[2], -1, t_import-t_start, now()-t_import);
     
     return 0;
 }
-
@@ -0,0 +1,371 @@
+/*
+** o5mgen
+**
+** Writes a synthetic OpenStreetMap file in o5m format for benchmarking
+** o5m2sqlite. The output only depends on the options, the same options
+** give the same file on every machine.
+**
+** Nodes are placed on a random walk through a square area, so nodes with
+** neighbouring ids are near each other like in real data, and ways and
+** relations refer to runs of neighbouring nodes and ways. Tags are drawn
+** from a small vocabulary and go through the o5m string table.
+**
+**   gcc -O2 o5mgen.c -o o5mgen
+**   ./o5mgen --nodes=1000000 bench.o5m
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define O5MGEN_HELP \
+"o5mgen: write a synthetic o5m file\n\n" \
+"Usage:\n" \
+"o5mgen [options] out.o5m\n\n" \
+"Options:\n" \
+"--nodes=N\tnodes (default 1000000)\n" \
+"--ways=N\tways (default nodes/10)\n" \
+"--relations=N\trelations (default ways/20)\n" \
+"--area=DEG\tside of the square the nodes are spread over, in degrees;\n" \
+"\t\tsets the node density (default 1)\n" \
+"--tagged=P\tpercent of the nodes with tags (default 5), ways and\n" \
+"\t\trelations are always tagged\n" \
+"--tags=N\ttags per tagged entity, distinct keys, at most 12 (default 2)\n" \
+"--way-nodes=N\taverage nodes per way (default 8)\n" \
+"--members=N\taverage members per relation (default 6)\n" \
+"--reset=N\twrite a reset every N datasets (default 0: only between the\n" \
+"\t\tnode, way and relation sections, like osmconvert)\n" \
+"--seed=N\tseed of the random generator (default 1)\n"
+
+/* o5m string table: 15000 entries of strings up to 250 bytes */
+#define STR_TABLE_SIZE 15000
+#define STR_MAX_LEN 250
+#define STR_HASH_SIZE 32768
+
+/* shape options */
+uint64_t n_nodes = 1000000, n_ways = 0, n_relations = 0;
+double area = 1;
+int tagged = 5, tags_per_entity = 2, way_nodes = 8, members = 6;
+uint64_t reset_every = 0;
+uint64_t seed = 1;
+
+static const char *keys[] = { "highway", "building", "name", "amenity", "landuse", "natural",
+    "surface", "oneway", "source", "addr:street", "addr:housenumber", "maxspeed" };
+static const char *values[] = { "residential", "yes", "primary", "service", "track", "footway",
+    "asphalt", "no", "forest", "water", "survey", "30", "50", "Main Street", "1", "2", "12a" };
+static const char *roles[] = { "outer", "inner", "", "stop", "platform", "forward" };
+
+/* xorshift64* */
+static uint64_t rnd( void ) {
+    seed ^= seed >> 12;
+    seed ^= seed << 25;
+    seed ^= seed >> 27;
+    return seed * 2685821657736338717ULL;
+}
+
+/* uniform in 0 .. n-1 */
+static uint64_t rnd_below( uint64_t n ) {
+    return n ? rnd() % n : 0;
+}
+
+/* around avg, 1 .. 2*avg-1 */
+static int rnd_count( int avg ) {
+    return avg>1 ? 1 + (int)rnd_below(2*avg-1) : 1;
+}
+
+typedef struct { uint8_t *p; size_t n, cap; } Buf;
+
+/*
+** A dataset is assembled in ds and written with its length once it is
+** complete, the node refs and members of a dataset in refs. The string
+** table keeps the strings in the order they were written, they are found
+** through a hash table of their positions.
+*/
+typedef struct {
+    Buf ds, refs;
+    char table[STR_TABLE_SIZE][STR_MAX_LEN+2];
+    uint64_t written;       /* strings added to the table since the last reset */
+    uint64_t hash[STR_HASH_SIZE];   /* written+1 of the string, 0 = empty */
+    int64_t id[3], ref[3];
+    int32_t lat, lon;
+    uint64_t datasets;      /* since the last reset */
+    FILE *out;
+    uint64_t bytes;
+} Writer;
+
+static void put_byte( Buf *b, uint8_t c ) {
+    if( b->n==b->cap ) {
+        b->cap = b->cap ? b->cap*2 : 4096;
+        b->p = realloc(b->p, b->cap);
+        if( b->p==NULL ) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    b->p[b->n++] = c;
+}
+
+static void put_uint( Buf *b, uint64_t v ) {
+    while( v>=0x80 ) {
+        put_byte(b, (uint8_t)v | 0x80);
+        v >>= 7;
+    }
+    put_byte(b, (uint8_t)v);
+}
+
+static void put_sint( Buf *b, int64_t v ) {
+    put_uint(b, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+static void write_raw( Writer *w, const void *p, size_t len ) {
+    if( fwrite(p, 1, len, w->out)!=len ) {
+        fprintf(stderr, "can't write the output file\n");
+        exit(1);
+    }
+    w->bytes += len;
+}
+
+static void reset( Writer *w ) {
+    uint8_t c = 0xff;
+    write_raw(w, &c, 1);
+    memset(w->hash, 0, sizeof(w->hash));
+    memset(w->id, 0, sizeof(w->id));
+    memset(w->ref, 0, sizeof(w->ref));
+    w->lat = w->lon = 0;
+    w->written = w->datasets = 0;
+}
+
+/* FNV-1a over len bytes */
+static uint32_t str_hash( const char *s, size_t len ) {
+    uint32_t h = 2166136261u;
+    while( len-- ) h = (h ^ (uint8_t)*s++) * 16777619u;
+    return h;
+}
+
+/* a string or string pair of len bytes including its terms 0 terminators */
+static void put_string( Writer *w, Buf *b, const char *s, size_t len, size_t terms ) {
+    uint32_t h = str_hash(s, len) & (STR_HASH_SIZE-1);
+    uint64_t pos = w->hash[h];
+    size_t i;
+
+    // a reference to the table if the string is still in it
+    if( pos && w->written-(pos-1)<=STR_TABLE_SIZE && memcmp(w->table[(pos-1)%STR_TABLE_SIZE],s,len)==0 ) {
+        put_uint(b, w->written-(pos-1));
+        return;
+    }
+    put_byte(b, 0);
+    for( i=0; i<len; i++ ) put_byte(b, s[i]);
+    // the table limit counts the characters without the terminators
+    if( len-terms>STR_MAX_LEN ) return;
+    memcpy(w->table[w->written%STR_TABLE_SIZE], s, len);
+    w->hash[h] = ++w->written;
+}
+
+/* n tags with distinct keys, at most one per key */
+static void put_tags( Writer *w, int n ) {
+    const int n_keys = (int)(sizeof(keys)/sizeof(keys[0]));
+    char pair[STR_MAX_LEN+2];
+    int order[sizeof(keys)/sizeof(keys[0])];
+    const char *k, *v;
+    int i, j, t;
+
+    // draw the keys without replacement, a partial Fisher-Yates shuffle
+    if( n>n_keys ) n = n_keys;
+    for( i=0; i<n_keys; i++ ) order[i] = i;
+    for( i=0; i<n; i++ ) {
+        j = i + (int)rnd_below(n_keys-i);
+        t = order[i]; order[i] = order[j]; order[j] = t;
+        k = keys[order[i]];
+        v = values[rnd_below(sizeof(values)/sizeof(values[0]))];
+        memcpy(pair, k, strlen(k)+1);
+        memcpy(pair+strlen(k)+1, v, strlen(v)+1);
+        put_string(w, &w->ds, pair, strlen(k)+strlen(v)+2, 2);
+    }
+}
+
+/* start a dataset of type 0, 1, 2 (node, way, relation) with id and no version */
+static void begin_dataset( Writer *w, int type, int64_t id ) {
+    put_sint(&w->ds, id - w->id[type]);
+    w->id[type] = id;
+    put_byte(&w->ds, 0);
+}
+
+/* append the refs of the dataset with their length */
+static void put_refs( Writer *w ) {
+    size_t i;
+    put_uint(&w->ds, w->refs.n);
+    for( i=0; i<w->refs.n; i++ ) put_byte(&w->ds, w->refs.p[i]);
+    w->refs.n = 0;
+}
+
+/* write the dataset assembled in ds */
+static void end_dataset( Writer *w, uint8_t type ) {
+    uint8_t head[11];
+    size_t n = 1, len = w->ds.n;
+
+    head[0] = type;
+    while( len>=0x80 ) {
+        head[n++] = (uint8_t)len | 0x80;
+        len >>= 7;
+    }
+    head[n++] = (uint8_t)len;
+    write_raw(w, head, n);
+    write_raw(w, w->ds.p, w->ds.n);
+    w->ds.n = 0;
+    if( reset_every && ++w->datasets>=reset_every ) reset(w);
+}
+
+/* the node ids are 1, 2, ... with gaps, the ways and relations refer to these */
+static int64_t node_id( uint64_t i ) {
+    return (int64_t)(i + i/4 + 1);
+}
+
+static void write_nodes( Writer *w ) {
+    int32_t range = (int32_t)(area*1E7), step = range/2000 > 0 ? range/2000 : 1;
+    int32_t lat = 475000000, lon = 85000000, lat0 = lat - range/2, lon0 = lon - range/2;
+    uint64_t i;
+
+    for( i=0; i<n_nodes; i++ ) {
+        // random walk, reflected at the borders of the area
+        lat += (int32_t)rnd_below(2*step+1) - step;
+        lon += (int32_t)rnd_below(2*step+1) - step;
+        if( lat<lat0 || lat>lat0+range ) lat = 2*(lat<lat0 ? lat0 : lat0+range) - lat;
+        if( lon<lon0 || lon>lon0+range ) lon = 2*(lon<lon0 ? lon0 : lon0+range) - lon;
+        begin_dataset(w, 0, node_id(i));
+        put_sint(&w->ds, (int64_t)lon - w->lon);
+        put_sint(&w->ds, (int64_t)lat - w->lat);
+        w->lon = lon;
+        w->lat = lat;
+        if( rnd_below(100)<(uint64_t)tagged ) put_tags(w, tags_per_entity);
+        end_dataset(w, 0x10);
+    }
+}
+
+static void write_ways( Writer *w ) {
+    uint64_t i, first;
+    int64_t ref;
+    int j, n;
+
+    for( i=0; i<n_ways; i++ ) {
+        begin_dataset(w, 1, (int64_t)(2*i+1));
+        n = rnd_count(way_nodes);
+        if( n<2 ) n = 2;
+        // a run of nodes near the position of the way in the file
+        first = n_nodes*i/n_ways + rnd_below(64);
+        for( j=0; j<n; j++ ) {
+            ref = node_id((first+j)%n_nodes);
+            put_sint(&w->refs, ref - w->ref[0]);
+            w->ref[0] = ref;
+        }
+        put_refs(w);
+        put_tags(w, tags_per_entity);
+        end_dataset(w, 0x11);
+    }
+}
+
+static void write_relations( Writer *w ) {
+    char role[STR_MAX_LEN+2];
+    uint64_t i, way;
+    int64_t ref;
+    int j, n, type;
+
+    for( i=0; i<n_relations; i++ ) {
+        begin_dataset(w, 2, (int64_t)(i+1));
+        n = rnd_count(members);
+        way = n_ways*i/n_relations;
+        for( j=0; j<n; j++ ) {
+            // mostly neighbouring ways, some nodes and earlier relations
+            type = rnd_below(10)<7 ? 1 : rnd_below(3)==0 && i>0 ? 2 : 0;
+            if( type==1 && n_ways==0 ) type = 0;
+            if( type==0 ) ref = node_id(rnd_below(n_nodes));
+            else if( type==1 ) ref = (int64_t)(2*((way+j)%n_ways)+1);
+            else ref = (int64_t)(rnd_below(i)+1);
+            put_sint(&w->refs, ref - w->ref[type]);
+            w->ref[type] = ref;
+            // member type and role are one string
+            role[0] = '0'+type;
+            strcpy(role+1, roles[rnd_below(sizeof(roles)/sizeof(roles[0]))]);
+            put_string(w, &w->refs, role, strlen(role)+1, 1);
+        }
+        put_refs(w);
+        put_tags(w, tags_per_entity);
+        end_dataset(w, 0x12);
+    }
+}
+
+int main( int narg, char *arg[] ) {
+    static Writer w;
+    const uint8_t header[] = { 0xe0, 0x04, 'o', '5', 'm', '2' };
+    const uint8_t end = 0xfe;
+    int i = 1, ways_set = 0, relations_set = 0;
+
+    while( i<narg && strncmp(arg[i],"--",2)==0 ) {
+        if( strncmp(arg[i],"--nodes=",8)==0 && atoll(arg[i]+8)>0 ) {
+            n_nodes = atoll(arg[i]+8);
+        }
+        else if( strncmp(arg[i],"--ways=",7)==0 && atoll(arg[i]+7)>=0 ) {
+            n_ways = atoll(arg[i]+7);
+            ways_set = 1;
+        }
+        else if( strncmp(arg[i],"--relations=",12)==0 && atoll(arg[i]+12)>=0 ) {
+            n_relations = atoll(arg[i]+12);
+            relations_set = 1;
+        }
+        else if( strncmp(arg[i],"--area=",7)==0 && atof(arg[i]+7)>0 && atof(arg[i]+7)<=80 ) {
+            area = atof(arg[i]+7);
+        }
+        else if( strncmp(arg[i],"--tagged=",9)==0 && atoi(arg[i]+9)>=0 && atoi(arg[i]+9)<=100 ) {
+            tagged = atoi(arg[i]+9);
+        }
+        else if( strncmp(arg[i],"--tags=",7)==0 && atoi(arg[i]+7)>=0 ) {
+            tags_per_entity = atoi(arg[i]+7);
+        }
+        else if( strncmp(arg[i],"--way-nodes=",12)==0 && atoi(arg[i]+12)>0 ) {
+            way_nodes = atoi(arg[i]+12);
+        }
+        else if( strncmp(arg[i],"--members=",10)==0 && atoi(arg[i]+10)>0 ) {
+            members = atoi(arg[i]+10);
+        }
+        else if( strncmp(arg[i],"--reset=",8)==0 && atoll(arg[i]+8)>=0 ) {
+            reset_every = atoll(arg[i]+8);
+        }
+        else if( strncmp(arg[i],"--seed=",7)==0 && atoll(arg[i]+7)>0 ) {
+            seed = atoll(arg[i]+7);
+        }
+        else {
+            fprintf(stderr, O5MGEN_HELP);
+            return 1;
+        }
+        i++;
+    }
+    if( narg-i<1 ) {
+        fprintf(stderr, O5MGEN_HELP);
+        return 1;
+    }
+    if( !ways_set ) n_ways = n_nodes/10;
+    if( !relations_set ) n_relations = n_ways/20;
+    if( n_nodes==0 ) n_ways = n_relations = 0;
+
+    w.out = fopen(arg[i], "wb");
+    if( w.out==NULL ) {
+        fprintf(stderr, "can't open %s\n", arg[i]);
+        return 1;
+    }
+    reset(&w);
+    write_raw(&w, header, sizeof(header));
+    write_nodes(&w);
+    reset(&w);
+    write_ways(&w);
+    reset(&w);
+    write_relations(&w);
+    write_raw(&w, &end, 1);
+    if( fclose(w.out)!=0 ) {
+        fprintf(stderr, "can't write %s\n", arg[i]);
+        return 1;
+    }
+    fprintf(stderr, "%s: %llu nodes, %llu ways, %llu relations, %.1f MB\n", arg[i], (unsigned long long)n_nodes,
+        (unsigned long long)n_ways, (unsigned long long)n_relations, w.bytes/1048576.0);
+    free(w.ds.p);
+    free(w.refs.p);
+    return 0;
+}
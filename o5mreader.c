@@ -4,27 +4,204 @@
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 
 #define STR_PAIR_TABLE_SIZE 15000
 #define STR_PAIR_STRING_SIZE 256
+/* longest pair (both strings with their terminators) kept in the table */
+#define STR_PAIR_MAX_LENGTH 252
+/* alignment of the string pair table arena */
+#define STR_PAIR_TABLE_ALIGN 64
 
+/* block of the entity string arena, see o5mreader_readEntity */
+#define O5MREADER_ARENA_BLOCK_SIZE (64*1024)
 
-O5mreaderRet o5mreader_readUInt(O5mreader *pReader, uint64_t *ret) {
-	uint8_t b;
-	uint8_t i = 0;
-	*ret = 0LL;
-		
-	do  {
-		if ( fread(&b,1,1,pReader->f) == 0 ) {
+/* read buffer of unmapped input, see o5mreader_setBufferSize */
+static size_t o5mreaderBufferSize = O5MREADER_BUFFER_SIZE;
+
+struct O5mreaderArenaBlock {
+	struct O5mreaderArenaBlock *next;
+	char data[O5MREADER_ARENA_BLOCK_SIZE];
+};
+
+
+/*
+** Input layer. Regular files are mmap'd and decoded in place, everything
+** else goes through an owned read buffer that is refilled (and compacted)
+** on demand. The decode position is a pointer, so there is no stdio call
+** per byte and no ftell/fseek on the hot path.
+*/
+static int o5mreader_mapInput(O5mreader *pReader) {
+#if !defined(_WIN32)
+	struct stat st;
+	long start;
+	void *map;
+	int fd = fileno(pReader->f);
+	
+	if ( fd < 0 || fstat(fd,&st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 )
+		return 0;
+	start = ftell(pReader->f);
+	if ( start < 0 || start > st.st_size )
+		return 0;
+	map = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	if ( map == MAP_FAILED )
+		return 0;
+	madvise(map,st.st_size,MADV_SEQUENTIAL);
+	pReader->buf = map;
+	pReader->bufSize = st.st_size;
+	pReader->bufBase = 0;
+	pReader->pos = pReader->buf + start;
+	pReader->end = pReader->buf + st.st_size;
+	pReader->isMapped = 1;
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+static void o5mreader_unmapInput(O5mreader *pReader) {
+#if !defined(_WIN32)
+	if ( pReader->isMapped && pReader->buf )
+		munmap(pReader->buf,pReader->bufSize);
+#endif
+	pReader->buf = pReader->pos = pReader->end = NULL;
+	pReader->isMapped = 0;
+}
+
+/* make at least 'need' bytes available at pos, returns the number available */
+static size_t o5mreader_fill(O5mreader *pReader, size_t need) {
+	size_t avail = pReader->end - pReader->pos;
+	size_t n;
+	
+	if ( avail >= need || pReader->isMapped )
+		return avail;
+	if ( pReader->pos != pReader->buf ) {
+		memmove(pReader->buf,pReader->pos,avail);
+		pReader->bufBase += pReader->pos - pReader->buf;
+		pReader->pos = pReader->buf;
+		pReader->end = pReader->buf + avail;
+	}
+	while ( avail < need && avail < pReader->bufSize ) {
+		n = fread(pReader->end,1,pReader->bufSize - avail,pReader->f);
+		if ( n == 0 )
+			break;
+		pReader->end += n;
+		avail += n;
+	}
+	return avail;
+}
+
+uint64_t o5mreader_tell(O5mreader *pReader) {
+	return pReader->bufBase + (pReader->pos - pReader->buf);
+}
+
+/* move the decode position forward to the absolute file offset 'to' */
+static O5mreaderRet o5mreader_skipTo(O5mreader *pReader, uint64_t to) {
+	uint64_t here = o5mreader_tell(pReader);
+	
+	while ( to > here ) {
+		if ( to - here <= (uint64_t)(pReader->end - pReader->pos) ) {
+			pReader->pos += to - here;
+			return O5MREADER_RET_OK;
+		}
+		here += pReader->end - pReader->pos;
+		pReader->pos = pReader->end;
+		if ( o5mreader_fill(pReader,1) == 0 ) {
 			o5mreader_setError(pReader,
 				O5MREADER_ERR_CODE_UNEXPECTED_END_OF_FILE,
 				NULL
 			);
 			return O5MREADER_RET_ERR;
 		}
-		*ret |= (long long)(b & 0x7f) << (i++ * 7);			
-	} while ( b & 0x80 );	
+	}
+	return O5MREADER_RET_OK;
+}
+
+static inline O5mreaderRet o5mreader_readByte(O5mreader *pReader, uint8_t *b) {
+	if ( pReader->pos == pReader->end && o5mreader_fill(pReader,1) == 0 ) {
+		o5mreader_setError(pReader,
+			O5MREADER_ERR_CODE_UNEXPECTED_END_OF_FILE,
+			NULL
+		);
+		return O5MREADER_RET_ERR;
+	}
+	*b = *pReader->pos++;
+	return O5MREADER_RET_OK;
+}
+
+/*
+** Branch-reduced varint kernel. On little-endian targets with at least 8
+** readable bytes a varint of up to 8 bytes (56 bits) is decoded from one
+** 64-bit load: the length comes from the first clear continuation bit and
+** the 7-bit groups are compacted with three shift/mask steps (SWAR), so
+** there is no per-byte branch. Longer varints and the last bytes of the
+** input take the scalar loop.
+*/
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define O5MREADER_SWAR_VARINT 1
+#endif
+
+static inline const uint8_t *o5mreader_decodeUInt(const uint8_t *p, const uint8_t *end, uint64_t *ret) {
+	uint64_t v = 0;
+	uint8_t b;
+	int i = 0;
+#ifdef O5MREADER_SWAR_VARINT
+	uint64_t w, stop;
+	int len;
+	
+	if ( p < end && !(*p & 0x80) ) {
+		*ret = *p;
+		return p + 1;
+	}
+	if ( end - p >= 8 ) {
+		memcpy(&w,p,8);
+		stop = ~w & 0x8080808080808080ULL;
+		if ( stop ) {
+			len = (__builtin_ctzll(stop) >> 3) + 1;
+			if ( len < 8 )
+				w &= (1ULL << (len * 8)) - 1;
+			w = ((w & 0x7f007f007f007f00ULL) >> 1) | (w & 0x007f007f007f007fULL);
+			w = ((w & 0x3fff00003fff0000ULL) >> 2) | (w & 0x00003fff00003fffULL);
+			w = ((w & 0x0fffffff00000000ULL) >> 4) | (w & 0x000000000fffffffULL);
+			*ret = w;
+			return p + len;
+		}
+	}
+#endif
+	do {
+		if ( p == end )
+			return NULL;
+		b = *p++;
+		v |= (uint64_t)(b & 0x7f) << (i++ * 7);
+	} while ( b & 0x80 );
+	*ret = v;
+	return p;
+}
+
+static inline int64_t o5mreader_unzigzag(uint64_t v) {
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+O5mreaderRet o5mreader_readUInt(O5mreader *pReader, uint64_t *ret) {
+	const uint8_t *p;
+	
+	if ( pReader->end - pReader->pos < 10 )
+		o5mreader_fill(pReader,10);
+	p = o5mreader_decodeUInt(pReader->pos,pReader->end,ret);
+	if ( !p ) {
+		pReader->pos = pReader->end;
+		o5mreader_setError(pReader,
+			O5MREADER_ERR_CODE_UNEXPECTED_END_OF_FILE,
+			NULL
+		);
+		return O5MREADER_RET_ERR;
+	}
+	pReader->pos = (uint8_t*)p;
 	
 	o5mreader_setNoError(pReader);
 	
@@ -41,12 +218,15 @@ O5mreaderRet o5mreader_readInt(O5mreader *pReader, uint64_t *ret) {
 }
 
 
+/* slot of the string pair table for the ring position idx */
+#define STR_PAIR_SLOT(pReader,idx) \
+	((pReader)->strPairTable + ((idx) % STR_PAIR_TABLE_SIZE) * STR_PAIR_STRING_SIZE)
+
 O5mreaderRet o5mreader_readStrPair(O5mreader *pReader, char **tagpair, int single) {	
-	static char buffer[1024];
-	char* pBuf;
-	static uint64_t pointer = 0;
-	int length;
-	char byte;
+	char* buffer = pReader->strBuffer;
+	uint8_t *p, *end, *q;
+	size_t length;
+	uint8_t byte;
 	uint64_t key; 
 	int i;
 	
@@ -55,33 +235,52 @@ O5mreaderRet o5mreader_readStrPair(O5mreader *pReader, char **tagpair, int singl
 	}
 	
 	if ( key ) {
-		*tagpair = pReader->strPairTable[(pointer+15000-key)%15000];		
-		return key;
+		pReader->lastPairIndex = pReader->strPairPointer + STR_PAIR_TABLE_SIZE - key;
+		*tagpair = STR_PAIR_SLOT(pReader,pReader->lastPairIndex);
+		return O5MREADER_RET_OK;
 	}
-	else {
-		pBuf = buffer;
-		for ( i=0; i<(single?1:2); i++ ) {
-			do {
-				if ( fread(pBuf,1,1,pReader->f) == 0 ) {
-					o5mreader_setError(pReader,
-						O5MREADER_ERR_CODE_UNEXPECTED_END_OF_FILE,
-						NULL
-					);
-					return O5MREADER_RET_ERR;
-				}
-			} while ( *(pBuf++) );
-		}			
-		
-		length = strlen(buffer) + (single ? 1 : strlen(buffer+strlen(buffer) +1) + 2);
-		
-		if ( length <= 252 ) {			
-			*tagpair = pReader->strPairTable[(pointer+15000)%15000];			
-			memcpy(pReader->strPairTable[((pointer++)+15000)%15000],buffer,length);						
+	
+	/* fast path: the whole pair is inside the input window, copy it straight into its slot */
+	o5mreader_fill(pReader,STR_PAIR_MAX_LENGTH);
+	p = pReader->pos;
+	end = pReader->end;
+	q = memchr(p,0,end - p);
+	if ( q && !single )
+		q = memchr(q + 1,0,end - q - 1);
+	if ( q && (size_t)(q + 1 - p) <= O5MREADER_STR_BUFFER_SIZE ) {
+		length = q + 1 - p;
+		if ( length <= STR_PAIR_MAX_LENGTH ) {
+			pReader->lastPairIndex = pReader->strPairPointer + STR_PAIR_TABLE_SIZE;
+			*tagpair = STR_PAIR_SLOT(pReader,pReader->strPairPointer++);
 		}
 		else {
+			pReader->lastPairIndex = 0;
 			*tagpair = buffer;
 		}
-				
+		memcpy(*tagpair,p,length);
+		pReader->pos = q + 1;
+		return O5MREADER_RET_OK;
+	}
+	
+	/* slow path at the end of the input window or for overlong strings, which are truncated */
+	length = 0;
+	for ( i=0; i<(single?1:2); i++ ) {
+		do {
+			if ( o5mreader_readByte(pReader,&byte) == O5MREADER_RET_ERR )
+				return O5MREADER_RET_ERR;
+			if ( byte ? length < O5MREADER_STR_BUFFER_SIZE - 2 : length < O5MREADER_STR_BUFFER_SIZE )
+				buffer[length++] = byte;
+		} while ( byte );
+	}
+	
+	if ( length <= STR_PAIR_MAX_LENGTH ) {
+		pReader->lastPairIndex = pReader->strPairPointer + STR_PAIR_TABLE_SIZE;
+		*tagpair = STR_PAIR_SLOT(pReader,pReader->strPairPointer++);
+		memcpy(*tagpair,buffer,length);
+	}
+	else {
+		pReader->lastPairIndex = 0;
+		*tagpair = buffer;
 	}
 	
 	return O5MREADER_RET_OK;
@@ -91,23 +290,82 @@ O5mreaderRet o5mreader_reset(O5mreader *pReader) {
 	pReader->nodeId = pReader->wayId = pReader->wayNodeId = pReader->relId = pReader->nodeRefId = pReader->wayRefId = pReader->relRefId = 0;	
 	pReader->lon = pReader->lat = 0;
 	pReader->offset = 0;	
+	pReader->pairBase += pReader->strPairPointer + STR_PAIR_TABLE_SIZE;
+	pReader->strPairPointer = 0;
 	pReader->canIterateTags = pReader->canIterateNds = pReader->canIterateRefs = 0;
+	return O5MREADER_RET_OK;
 }
 
-O5mreaderRet o5mreader_open(O5mreader **ppReader,FILE* f) {
-	uint8_t byte;
-	int i;
-	*ppReader = malloc(sizeof(O5mreader));
+/*
+** The reader and its string pair table are one allocation: the table is a
+** contiguous, cache-line aligned arena of STR_PAIR_TABLE_SIZE slots placed
+** behind the (padded) O5mreader struct.
+*/
+#define O5MREADER_ALLOC_HEAD \
+	((sizeof(O5mreader) + STR_PAIR_TABLE_ALIGN - 1) / STR_PAIR_TABLE_ALIGN * STR_PAIR_TABLE_ALIGN)
+
+static O5mreader *o5mreader_alloc(void) {
+	size_t size = O5MREADER_ALLOC_HEAD + (size_t)STR_PAIR_TABLE_SIZE * STR_PAIR_STRING_SIZE;
+	void *p;
+#if defined(_WIN32)
+	p = _aligned_malloc(size,STR_PAIR_TABLE_ALIGN);
+#else
+	if ( posix_memalign(&p,STR_PAIR_TABLE_ALIGN,size) != 0 )
+		p = NULL;
+#endif
+	return p;
+}
+
+static void o5mreader_free(O5mreader *pReader) {
+#if defined(_WIN32)
+	_aligned_free(pReader);
+#else
+	free(pReader);
+#endif
+}
+
+/* allocate a reader on f at its current position */
+static O5mreaderRet o5mreader_init(O5mreader **ppReader,FILE* f) {
+	*ppReader = o5mreader_alloc();
 	if ( !(*ppReader) ) {
 		return O5MREADER_RET_ERR;
 	}
 	(*ppReader)->errMsg = NULL;
 	(*ppReader)->f = f;	
-	if ( fread(&byte,1,1,(*ppReader)->f) == 0 ) {
-		o5mreader_setError(*ppReader,
-			O5MREADER_ERR_CODE_UNEXPECTED_END_OF_FILE,
-			NULL
-		);	
+	(*ppReader)->strPairTable = (char*)(*ppReader) + O5MREADER_ALLOC_HEAD;
+	(*ppReader)->limit = 0;
+	(*ppReader)->buf = NULL;
+	memset(&(*ppReader)->entity,0,sizeof(O5mreaderEntity));
+	(*ppReader)->tagCap = (*ppReader)->ndCap = (*ppReader)->memberCap = 0;
+	(*ppReader)->arenaFirst = (*ppReader)->arenaCur = NULL;
+	(*ppReader)->arenaUsed = 0;
+	(*ppReader)->strPairPointer = 0;
+	(*ppReader)->pairBase = 0;
+	(*ppReader)->filter = NULL;
+	(*ppReader)->filterData = NULL;
+	if ( !o5mreader_mapInput(*ppReader) ) {
+		(*ppReader)->isMapped = 0;
+		(*ppReader)->bufBase = ftell(f) < 0 ? 0 : ftell(f);
+		(*ppReader)->bufSize = o5mreaderBufferSize;
+		(*ppReader)->buf = malloc(o5mreaderBufferSize);
+		if ( (*ppReader)->buf == 0 ) {
+			o5mreader_setError(*ppReader,
+				O5MREADER_ERR_CODE_MEMORY_ERROR,
+				NULL
+			);
+			return O5MREADER_RET_ERR;
+		}
+		(*ppReader)->pos = (*ppReader)->end = (*ppReader)->buf;
+	}
+	return O5MREADER_RET_OK;
+}
+
+O5mreaderRet o5mreader_open(O5mreader **ppReader,FILE* f) {
+	uint8_t byte;
+	if ( o5mreader_init(ppReader,f) == O5MREADER_RET_ERR ) {
+		return O5MREADER_RET_ERR;
+	}
+	if ( o5mreader_readByte(*ppReader,&byte) == O5MREADER_RET_ERR ) {
 		return O5MREADER_RET_ERR;
 	}
 	if ( byte != O5MREADER_DS_RESET ) {
@@ -120,40 +378,192 @@ O5mreaderRet o5mreader_open(O5mreader **ppReader,FILE* f) {
 	
 	o5mreader_reset(*ppReader);
 	
-	(*ppReader)->strPairTable = malloc(STR_PAIR_TABLE_SIZE*sizeof(char*));
-	if ( (*ppReader)->strPairTable == 0 ) {
-		o5mreader_setError(*ppReader,
-			O5MREADER_ERR_CODE_MEMORY_ERROR,
-			NULL
-		);
+	o5mreader_setNoError(*ppReader);
+	return O5MREADER_RET_OK;
+}
+
+/*
+** Open a reader on the byte range [start,end) of f. The range has to begin
+** with a RESET (0xff) dataset, iteration reports DONE when end is reached.
+*/
+O5mreaderRet o5mreader_openRange(O5mreader **ppReader,FILE* f,uint64_t start,uint64_t end) {
+	if ( fseek(f,start,SEEK_SET) != 0 ) {
+		*ppReader = NULL;
 		return O5MREADER_RET_ERR;
 	}
-	for ( i = 0; i < STR_PAIR_TABLE_SIZE; ++i ) {
-		(*ppReader)->strPairTable[i] = malloc(sizeof(char)*STR_PAIR_STRING_SIZE);
-		if ( (*ppReader)->strPairTable[i] == 0 ) {
-			o5mreader_setError(*ppReader,
-				O5MREADER_ERR_CODE_MEMORY_ERROR,
-				NULL
-			);
-			return O5MREADER_RET_ERR;
-		}
-	}
+	if ( o5mreader_open(ppReader,f) == O5MREADER_RET_ERR )
+		return O5MREADER_RET_ERR;
+	(*ppReader)->limit = end;
+	return O5MREADER_RET_OK;
+}
+
+/*
+** Decoder state at a dataset boundary: the delta coding bases and the used
+** slots of the string pair table, so that a later reader can continue at
+** the offset returned by o5mreader_saveState. Right after a reset only a
+** few slots are in use. The state is in host byte order.
+*/
+typedef struct {
+	uint32_t magic;
+	uint32_t slots;
+	int64_t nodeId, wayId, wayNodeId, relId, nodeRefId, wayRefId, relRefId;
+	int32_t lon, lat;
+	uint64_t strPairPointer, pairBase;
+} O5mreaderState;
+
+#define O5MREADER_STATE_MAGIC 0x6f356d31
+
+static uint32_t o5mreader_usedSlots(O5mreader *pReader) {
+	return pReader->strPairPointer < STR_PAIR_TABLE_SIZE ? (uint32_t)pReader->strPairPointer : STR_PAIR_TABLE_SIZE;
+}
+
+/* bytes o5mreader_saveState writes */
+size_t o5mreader_stateSize(O5mreader *pReader) {
+	return sizeof(O5mreaderState) + (size_t)o5mreader_usedSlots(pReader) * STR_PAIR_STRING_SIZE;
+}
+
+/*
+** Write the state after the entity read last into state (o5mreader_stateSize
+** bytes) and return the offset of the next dataset.
+*/
+uint64_t o5mreader_saveState(O5mreader *pReader, void *state) {
+	O5mreaderState st;
+	
+	st.magic = O5MREADER_STATE_MAGIC;
+	st.slots = o5mreader_usedSlots(pReader);
+	st.nodeId = pReader->nodeId;
+	st.wayId = pReader->wayId;
+	st.wayNodeId = pReader->wayNodeId;
+	st.relId = pReader->relId;
+	st.nodeRefId = pReader->nodeRefId;
+	st.wayRefId = pReader->wayRefId;
+	st.relRefId = pReader->relRefId;
+	st.lon = pReader->lon;
+	st.lat = pReader->lat;
+	st.strPairPointer = pReader->strPairPointer;
+	st.pairBase = pReader->pairBase;
+	memcpy(state,&st,sizeof(st));
+	memcpy((char*)state + sizeof(st),pReader->strPairTable,(size_t)st.slots * STR_PAIR_STRING_SIZE);
+	return pReader->offset ? pReader->current + pReader->offset : o5mreader_tell(pReader);
+}
+
+/*
+** Open a reader that continues at offset start of f with a state saved by
+** o5mreader_saveState. Inputs that can't seek are read up to start.
+*/
+O5mreaderRet o5mreader_openState(O5mreader **ppReader,FILE* f,uint64_t start,const void *state,size_t size) {
+	O5mreaderState st;
 	
+	*ppReader = NULL;
+	if ( size < sizeof(st) )
+		return O5MREADER_RET_ERR;
+	memcpy(&st,state,sizeof(st));
+	if ( st.magic != O5MREADER_STATE_MAGIC || st.slots > STR_PAIR_TABLE_SIZE ||
+		size != sizeof(st) + (size_t)st.slots * STR_PAIR_STRING_SIZE )
+		return O5MREADER_RET_ERR;
+	fseek(f,start,SEEK_SET);
+	if ( o5mreader_init(ppReader,f) == O5MREADER_RET_ERR )
+		return O5MREADER_RET_ERR;
+	o5mreader_reset(*ppReader);
+	if ( o5mreader_tell(*ppReader) != start && o5mreader_skipTo(*ppReader,start) == O5MREADER_RET_ERR )
+		return O5MREADER_RET_ERR;
+	(*ppReader)->nodeId = st.nodeId;
+	(*ppReader)->wayId = st.wayId;
+	(*ppReader)->wayNodeId = st.wayNodeId;
+	(*ppReader)->relId = st.relId;
+	(*ppReader)->nodeRefId = st.nodeRefId;
+	(*ppReader)->wayRefId = st.wayRefId;
+	(*ppReader)->relRefId = st.relRefId;
+	(*ppReader)->lon = st.lon;
+	(*ppReader)->lat = st.lat;
+	(*ppReader)->strPairPointer = st.strPairPointer;
+	(*ppReader)->pairBase = st.pairBase;
+	memcpy((*ppReader)->strPairTable,(const char*)state + sizeof(st),(size_t)st.slots * STR_PAIR_STRING_SIZE);
 	o5mreader_setNoError(*ppReader);
 	return O5MREADER_RET_OK;
 }
 
+/*
+** Walk the dataset framing of f (without decoding any dataset) and collect
+** the offsets of RESET datasets which start independently decodable chunks
+** of at least minChunk bytes. The first entry is 0, the last one is the end
+** of the data, so chunk i is [offsets[i],offsets[i+1]). Free *pOffsets with free().
+*/
+O5mreaderRet o5mreader_scanResets(FILE* f,uint64_t minChunk,uint64_t **pOffsets,size_t *pCount) {
+	O5mreader *pReader = NULL;
+	uint64_t *offsets = NULL, *tmp;
+	size_t count = 0, cap = 0;
+	uint64_t here, len;
+	uint8_t type;
+	
+	*pOffsets = NULL;
+	*pCount = 0;
+	if ( fseek(f,0,SEEK_SET) != 0 )
+		return O5MREADER_RET_ERR;
+	/* a wrong first byte fails the open with the reader already allocated */
+	if ( o5mreader_open(&pReader,f) == O5MREADER_RET_ERR ) {
+		o5mreader_close(pReader);
+		return O5MREADER_RET_ERR;
+	}
+	
+	for (;;) {
+		here = o5mreader_tell(pReader);
+		if ( pReader->pos == pReader->end && o5mreader_fill(pReader,1) == 0 )
+			type = O5MREADER_DS_END;
+		else if ( o5mreader_readByte(pReader,&type) == O5MREADER_RET_ERR )
+			break;
+		if ( count + 2 > cap ) {
+			cap = cap ? 2*cap : 64;
+			tmp = realloc(offsets,cap*sizeof(uint64_t));
+			if ( !tmp )
+				break;
+			offsets = tmp;
+		}
+		if ( count == 0 ) {
+			offsets[count++] = 0;
+		}
+		if ( type == O5MREADER_DS_END ) {
+			offsets[count++] = here;
+			*pOffsets = offsets;
+			*pCount = count;
+			o5mreader_close(pReader);
+			return O5MREADER_RET_OK;
+		}
+		if ( type == O5MREADER_DS_RESET ) {
+			if ( here - offsets[count-1] >= minChunk )
+				offsets[count++] = here;
+		}
+		else if ( type < 0xf0 ) {
+			if ( o5mreader_readUInt(pReader,&len) == O5MREADER_RET_ERR ||
+				o5mreader_skipTo(pReader,o5mreader_tell(pReader) + len) == O5MREADER_RET_ERR )
+				break;
+		}
+	}
+	free(offsets);
+	o5mreader_close(pReader);
+	return O5MREADER_RET_ERR;
+}
+
+void o5mreader_setBufferSize(size_t size) {
+	o5mreaderBufferSize = size;
+}
+
 void o5mreader_close(O5mreader *pReader) {
-	int i;
 	if ( pReader ) {
-		if ( pReader->strPairTable ) {
-			for ( i = 0; i < STR_PAIR_TABLE_SIZE; ++i )
-				if ( pReader->strPairTable[i] )
-					free(pReader->strPairTable[i]);
-			free(pReader->strPairTable);
-		}		
+		if ( pReader->isMapped )
+			o5mreader_unmapInput(pReader);
+		else
+			free(pReader->buf);
+		free(pReader->entity.tags);
+		free(pReader->entity.nds);
+		free(pReader->entity.members);
+		while ( pReader->arenaFirst ) {
+			pReader->arenaCur = pReader->arenaFirst->next;
+			free(pReader->arenaFirst);
+			pReader->arenaFirst = pReader->arenaCur;
+		}
 		o5mreader_setNoError(pReader);	
-		free(pReader);
+		o5mreader_free(pReader);
 	}
 }
 
@@ -198,23 +608,22 @@ void o5mreader_setNoError(O5mreader *pReader) {
 O5mreaderIterateRet o5mreader_iterateDataSet(O5mreader *pReader, O5mreaderDataset* ds) {
 	for (;;) {		
 		if ( pReader->offset ) {
-			if (  o5mreader_skipTags(pReader) == O5MREADER_ITERATE_RET_ERR )
+			/* the following datasets continue the ref deltas and the string table of this one */
+			if ( o5mreader_skipRefs(pReader) == O5MREADER_ITERATE_RET_ERR ||
+				o5mreader_skipNds(pReader) == O5MREADER_ITERATE_RET_ERR ||
+				o5mreader_skipTags(pReader) == O5MREADER_ITERATE_RET_ERR )
+				return O5MREADER_ITERATE_RET_ERR;
+
+			if ( o5mreader_skipTo(pReader,pReader->current + pReader->offset) == O5MREADER_RET_ERR )
 				return O5MREADER_ITERATE_RET_ERR;
-									
-			fseek(
-				pReader->f,
-				(pReader->current - ftell(pReader->f)) + pReader->offset,
-				SEEK_CUR
-			);
 			
 			pReader->offset = 0;
 		}
 		
-		if ( fread(&(ds->type),1,1,pReader->f) == 0 ) {
-			o5mreader_setError(pReader,
-				O5MREADER_ERR_CODE_UNEXPECTED_END_OF_FILE,
-				NULL
-			);
+		if ( pReader->limit && o5mreader_tell(pReader) >= pReader->limit )
+			return O5MREADER_ITERATE_RET_DONE;
+		
+		if ( o5mreader_readByte(pReader,&(ds->type)) == O5MREADER_RET_ERR ) {
 			return O5MREADER_ITERATE_RET_ERR;
 		}
 						
@@ -229,7 +638,7 @@ O5mreaderIterateRet o5mreader_iterateDataSet(O5mreader *pReader, O5mreaderDatase
 			if ( o5mreader_readUInt(pReader,&pReader->offset) == O5MREADER_RET_ERR ) {		
 				return O5MREADER_ITERATE_RET_ERR;
 			}
-			pReader->current = ftell(pReader->f);		
+			pReader->current = o5mreader_tell(pReader);		
 			
 			switch ( ds->type ) {
 				case O5MREADER_DS_NODE:					
@@ -255,7 +664,7 @@ O5mreaderIterateRet o5mreader_iterateDataSet(O5mreader *pReader, O5mreaderDatase
 }
 
 int o5mreader_thereAreNoMoreData(O5mreader *pReader) {	
-	return (int)((pReader->current - ftell(pReader->f)) + pReader->offset) <= 0;
+	return (int64_t)((pReader->current + pReader->offset) - o5mreader_tell(pReader)) <= 0;
 }
 
 O5mreaderIterateRet o5mreader_readVersion(O5mreader *pReader, O5mreaderDataset* ds) {
@@ -320,7 +729,7 @@ O5mreaderIterateRet o5mreader_iterateTags(O5mreader *pReader, char** pKey, char*
 }
 
 O5mreaderIterateRet o5mreader_skipTags(O5mreader *pReader) {
-	int ret;	
+	int ret = O5MREADER_ITERATE_RET_DONE;	
 	if ( pReader->canIterateTags ) {		
 		while ( O5MREADER_ITERATE_RET_NEXT == (ret = o5mreader_iterateTags(pReader, NULL, NULL)) );
 	}
@@ -378,7 +787,7 @@ O5mreaderIterateRet o5mreader_iterateNds(O5mreader *pReader, uint64_t *nodeId) {
 		);
 		return O5MREADER_ITERATE_RET_ERR;
 	}
-	if ( ftell(pReader->f) >= pReader->offsetNd ) {
+	if ( o5mreader_tell(pReader) >= pReader->offsetNd ) {
 		pReader->canIterateNds = 0;
 		pReader->canIterateTags = 1;
 		pReader->canIterateRefs = 0;
@@ -397,12 +806,75 @@ O5mreaderIterateRet o5mreader_iterateNds(O5mreader *pReader, uint64_t *nodeId) {
 }
 
 O5mreaderIterateRet o5mreader_skipNds(O5mreader *pReader) {
-	uint8_t ret;	
+	uint64_t nodeIds[256];
+	size_t count;
+	O5mreaderIterateRet ret = O5MREADER_ITERATE_RET_DONE;
 	while ( pReader->canIterateNds &&
-		O5MREADER_ITERATE_RET_NEXT == (ret = o5mreader_iterateNds(pReader, NULL)) );
+		O5MREADER_ITERATE_RET_NEXT == (ret = o5mreader_readNds(pReader, nodeIds, 256, &count)) );
 	return ret;
 }
 
+/*
+** Bulk variant of o5mreader_iterateNds: decodes up to maxCount node refs of
+** the current way into nodeIds. Returns NEXT if the array was filled and
+** more refs follow, DONE once the list is complete (*pCount may still be >0).
+*/
+O5mreaderIterateRet o5mreader_readNds(O5mreader *pReader, uint64_t *nodeIds, size_t maxCount, size_t *pCount) {
+	const uint8_t *p, *stop, *next;
+	uint64_t v, here, left, need;
+	int64_t id = pReader->wayNodeId;
+	size_t n = 0;
+	
+	*pCount = 0;
+	if ( !pReader->canIterateNds  ) {
+		o5mreader_setError(pReader,
+			O5MREADER_ERR_CODE_CAN_NOT_ITERATE_NDS_HERE,
+			NULL
+		);
+		return O5MREADER_ITERATE_RET_ERR;
+	}
+	
+	while ( n < maxCount && (here = o5mreader_tell(pReader)) < pReader->offsetNd ) {
+		left = pReader->offsetNd - here;
+		need = left < 16 ? left : 16;
+		if ( o5mreader_fill(pReader,need) < need )
+			break;
+		p = pReader->pos;
+		stop = (uint64_t)(pReader->end - p) > left ? p + left : pReader->end;
+		next = p;
+		while ( n < maxCount && p < stop ) {
+			next = o5mreader_decodeUInt(p,pReader->end,&v);
+			if ( !next )
+				break;
+			p = next;
+			id += o5mreader_unzigzag(v);
+			nodeIds[n++] = id;
+		}
+		if ( p == pReader->pos )
+			break;
+		pReader->pos = (uint8_t*)p;
+	}
+	if ( n < maxCount && o5mreader_tell(pReader) < pReader->offsetNd ) {
+		o5mreader_setError(pReader,
+			O5MREADER_ERR_CODE_UNEXPECTED_END_OF_FILE,
+			NULL
+		);
+		pReader->wayNodeId = id;
+		*pCount = n;
+		return O5MREADER_ITERATE_RET_ERR;
+	}
+	pReader->wayNodeId = id;
+	*pCount = n;
+	
+	if ( o5mreader_tell(pReader) >= pReader->offsetNd ) {
+		pReader->canIterateNds = 0;
+		pReader->canIterateTags = 1;
+		pReader->canIterateRefs = 0;
+		return O5MREADER_ITERATE_RET_DONE;
+	}
+	return O5MREADER_ITERATE_RET_NEXT;
+}
+
 O5mreaderIterateRet o5mreader_readWay(O5mreader *pReader, O5mreaderDataset* ds) {	
 	int64_t wayId;
 	if ( o5mreader_readInt(pReader,&wayId) == O5MREADER_RET_ERR)
@@ -419,40 +891,15 @@ O5mreaderIterateRet o5mreader_readWay(O5mreader *pReader, O5mreaderDataset* ds)
 	if ( o5mreader_readUInt(pReader,&pReader->offsetNd) == O5MREADER_RET_ERR ) {
 		return O5MREADER_ITERATE_RET_ERR;
 	}
-	pReader->offsetNd += ftell(pReader->f);
+	pReader->offsetNd += o5mreader_tell(pReader);
 	pReader->canIterateRefs = 0;	
 	pReader->canIterateNds = 1;	
 	pReader->canIterateTags = 0;
 	return O5MREADER_ITERATE_RET_NEXT;
 }
 
-O5mreaderIterateRet o5mreader_iterateRefs(O5mreader *pReader, uint64_t *refId, uint8_t *type, char** pRole) {
-	int64_t relRefId;	
-	
-	if ( !pReader->canIterateRefs  ) {
-		o5mreader_setError(pReader,
-			O5MREADER_ERR_CODE_CAN_NOT_ITERATE_REFS_HERE,
-			NULL
-		);
-		return O5MREADER_ITERATE_RET_ERR;
-	}
-	if ( ftell(pReader->f) >= pReader->offsetRf ) {
-		pReader->canIterateNds = 0;
-		pReader->canIterateTags = 1;
-		pReader->canIterateRefs = 0;
-		return O5MREADER_ITERATE_RET_DONE;
-	}
-			
-	if ( o5mreader_readInt(pReader, &relRefId) == O5MREADER_RET_ERR )
-		return O5MREADER_ITERATE_RET_ERR;
-			
-	
-	//fread(_,1,1,pReader->f);
-	
-	if ( o5mreader_readStrPair(pReader, &pReader->tagPair,1) == O5MREADER_RET_ERR ) {
-		return O5MREADER_ITERATE_RET_ERR;
-	}
-		
+/* apply a member id delta according to the member type in tagPair */
+static inline void o5mreader_applyRef(O5mreader *pReader, int64_t relRefId, uint64_t *refId, uint8_t *type) {
 	switch( pReader->tagPair[0] ) {
 		case '0': 
 			if ( type )
@@ -476,6 +923,33 @@ O5mreaderIterateRet o5mreader_iterateRefs(O5mreader *pReader, uint64_t *refId, u
 				*refId = pReader->relRefId;
 			break;
 	}
+}
+
+O5mreaderIterateRet o5mreader_iterateRefs(O5mreader *pReader, uint64_t *refId, uint8_t *type, char** pRole) {
+	int64_t relRefId;	
+	
+	if ( !pReader->canIterateRefs  ) {
+		o5mreader_setError(pReader,
+			O5MREADER_ERR_CODE_CAN_NOT_ITERATE_REFS_HERE,
+			NULL
+		);
+		return O5MREADER_ITERATE_RET_ERR;
+	}
+	if ( o5mreader_tell(pReader) >= pReader->offsetRf ) {
+		pReader->canIterateNds = 0;
+		pReader->canIterateTags = 1;
+		pReader->canIterateRefs = 0;
+		return O5MREADER_ITERATE_RET_DONE;
+	}
+			
+	if ( o5mreader_readInt(pReader, &relRefId) == O5MREADER_RET_ERR )
+		return O5MREADER_ITERATE_RET_ERR;
+	
+	if ( o5mreader_readStrPair(pReader, &pReader->tagPair,1) == O5MREADER_RET_ERR ) {
+		return O5MREADER_ITERATE_RET_ERR;
+	}
+		
+	o5mreader_applyRef(pReader,relRefId,refId,type);
 	
 	if ( pRole ) {
 		*pRole = pReader->tagPair + 1;
@@ -485,12 +959,55 @@ O5mreaderIterateRet o5mreader_iterateRefs(O5mreader *pReader, uint64_t *refId, u
 }
 
 O5mreaderIterateRet o5mreader_skipRefs(O5mreader *pReader) {
-	uint8_t ret;
+	int ret = O5MREADER_ITERATE_RET_DONE;
 	while ( pReader->canIterateRefs &&
 		O5MREADER_ITERATE_RET_NEXT == (ret = o5mreader_iterateRefs(pReader, NULL, NULL, NULL)) );
 	return ret;
 }
 
+/*
+** Bulk variant of o5mreader_iterateRefs: decodes up to maxCount members of
+** the current relation, same return convention as o5mreader_readNds. The
+** role pointers refer to the string pair table and stay valid until the
+** next call (roles longer than 250 bytes share one buffer, only the last
+** of them is valid).
+*/
+O5mreaderIterateRet o5mreader_readRefs(O5mreader *pReader, uint64_t *refIds, uint8_t *types, char** roles, size_t maxCount, size_t *pCount) {
+	uint64_t relRefId;
+	size_t n = 0;
+	
+	*pCount = 0;
+	if ( !pReader->canIterateRefs  ) {
+		o5mreader_setError(pReader,
+			O5MREADER_ERR_CODE_CAN_NOT_ITERATE_REFS_HERE,
+			NULL
+		);
+		return O5MREADER_ITERATE_RET_ERR;
+	}
+	
+	while ( n < maxCount && o5mreader_tell(pReader) < pReader->offsetRf ) {
+		if ( o5mreader_readInt(pReader, &relRefId) == O5MREADER_RET_ERR ||
+			o5mreader_readStrPair(pReader, &pReader->tagPair,1) == O5MREADER_RET_ERR ) {
+			*pCount = n;
+			return O5MREADER_ITERATE_RET_ERR;
+		}
+		refIds[n] = 0;
+		types[n] = 0;
+		o5mreader_applyRef(pReader,(int64_t)relRefId,&refIds[n],&types[n]);
+		roles[n] = pReader->tagPair + 1;
+		n++;
+	}
+	*pCount = n;
+	
+	if ( o5mreader_tell(pReader) >= pReader->offsetRf ) {
+		pReader->canIterateNds = 0;
+		pReader->canIterateTags = 1;
+		pReader->canIterateRefs = 0;
+		return O5MREADER_ITERATE_RET_DONE;
+	}
+	return O5MREADER_ITERATE_RET_NEXT;
+}
+
 O5mreaderIterateRet o5mreader_readRel(O5mreader *pReader, O5mreaderDataset* ds) {
 	int64_t relId;
 	if ( o5mreader_readInt(pReader,&relId) == O5MREADER_RET_ERR )
@@ -504,10 +1021,201 @@ O5mreaderIterateRet o5mreader_readRel(O5mreader *pReader, O5mreaderDataset* ds)
 	else
 		ds->isEmpty = 0;
 	o5mreader_readUInt(pReader,&pReader->offsetRf);
-	pReader->offsetRf += ftell(pReader->f);		
+	pReader->offsetRf += o5mreader_tell(pReader);		
 	
 	pReader->canIterateRefs = 1;	
 	pReader->canIterateNds = 0;	
 	pReader->canIterateTags = 0;
 	return O5MREADER_ITERATE_RET_NEXT;
 }
+
+/*
+** Whole-entity decoding. The arrays of the entity are owned by the reader
+** and only grow, so after warm-up decoding an entity does no allocation.
+** Tags point straight into the string pair table as long as their slots
+** can't be reused within the entity; roles, overlong strings and tags whose
+** slot is about to be overwritten are copied into a block arena that never
+** moves, so pointers handed out stay valid until the next entity.
+*/
+static int o5mreader_grow(O5mreader *pReader, void **p, size_t *cap, size_t need, size_t size) {
+	size_t n = *cap ? *cap : 64;
+	void *tmp;
+	if ( need <= *cap )
+		return 1;
+	while ( n < need )
+		n *= 2;
+	tmp = realloc(*p,n*size);
+	if ( !tmp ) {
+		o5mreader_setError(pReader,
+			O5MREADER_ERR_CODE_MEMORY_ERROR,
+			NULL
+		);
+		return 0;
+	}
+	*p = tmp;
+	*cap = n;
+	return 1;
+}
+
+/* copy len bytes of s (len <= O5MREADER_ARENA_BLOCK_SIZE) into the arena */
+static char *o5mreader_arenaStr(O5mreader *pReader, const char *s, size_t len) {
+	struct O5mreaderArenaBlock *block = pReader->arenaCur;
+	char *p;
+	if ( !block || pReader->arenaUsed + len > O5MREADER_ARENA_BLOCK_SIZE ) {
+		if ( block && block->next ) {
+			block = block->next;
+		}
+		else {
+			struct O5mreaderArenaBlock *b = malloc(sizeof(struct O5mreaderArenaBlock));
+			if ( !b ) {
+				o5mreader_setError(pReader,
+					O5MREADER_ERR_CODE_MEMORY_ERROR,
+					NULL
+				);
+				return NULL;
+			}
+			b->next = NULL;
+			if ( block )
+				block->next = b;
+			else
+				pReader->arenaFirst = b;
+			block = b;
+		}
+		pReader->arenaCur = block;
+		pReader->arenaUsed = 0;
+	}
+	p = block->data + pReader->arenaUsed;
+	memcpy(p,s,len);
+	pReader->arenaUsed += len;
+	return p;
+}
+
+static int o5mreader_arenaTag(O5mreader *pReader, O5mreaderTag *tag) {
+	size_t keyLen = tag->val - tag->key;
+	char *p = o5mreader_arenaStr(pReader,tag->key,keyLen + strlen(tag->val) + 1);
+	if ( !p )
+		return 0;
+	tag->key = p;
+	tag->val = p + keyLen;
+	return 1;
+}
+
+O5mreaderIterateRet o5mreader_readEntity(O5mreader *pReader, O5mreaderEntity **ppEntity) {
+	O5mreaderEntity *e = &pReader->entity;
+	O5mreaderIterateRet ret;
+	uint64_t refId;
+	uint8_t type;
+	char *role;
+	char *key, *val;
+	size_t count, i;
+	uint64_t oldest = (uint64_t)-1;
+	int copyTags = 0;
+	
+	*ppEntity = e;
+next:
+	e->tagCount = e->ndCount = e->memberCount = 0;
+	pReader->arenaCur = pReader->arenaFirst;
+	pReader->arenaUsed = 0;
+	copyTags = 0;
+	oldest = (uint64_t)-1;
+	
+	ret = o5mreader_iterateDataSet(pReader,&e->ds);
+	if ( ret != O5MREADER_ITERATE_RET_NEXT )
+		return ret;
+	if ( e->ds.isEmpty && e->ds.type != O5MREADER_DS_NODE )
+		return O5MREADER_ITERATE_RET_NEXT;
+	/* a rejected dataset is only scanned for its deltas and strings by the next iterateDataSet */
+	if ( pReader->filter && !e->ds.isEmpty && !pReader->filter(e,0,pReader->filterData) )
+		goto next;
+	
+	if ( e->ds.type == O5MREADER_DS_WAY ) {
+		do {
+			if ( !o5mreader_grow(pReader,(void**)&e->nds,&pReader->ndCap,e->ndCount + 256,sizeof(uint64_t)) )
+				return O5MREADER_ITERATE_RET_ERR;
+			ret = o5mreader_readNds(pReader,e->nds + e->ndCount,pReader->ndCap - e->ndCount,&count);
+			e->ndCount += count;
+		} while ( ret == O5MREADER_ITERATE_RET_NEXT );
+		if ( ret == O5MREADER_ITERATE_RET_ERR )
+			return O5MREADER_ITERATE_RET_ERR;
+	}
+	else if ( e->ds.type == O5MREADER_DS_REL ) {
+		/* one member at a time: its role may sit in strBuffer or in a table
+		   slot that the next member overwrites, so it is copied right away */
+		do {
+			ret = o5mreader_readRefs(pReader,&refId,&type,&role,1,&count);
+			if ( !count )
+				continue;
+			if ( e->memberCount == pReader->memberCap &&
+				!o5mreader_grow(pReader,(void**)&e->members,&pReader->memberCap,e->memberCount + 1,sizeof(O5mreaderMember)) )
+				return O5MREADER_ITERATE_RET_ERR;
+			e->members[e->memberCount].id = refId;
+			e->members[e->memberCount].type = type;
+			e->members[e->memberCount].role = o5mreader_arenaStr(pReader,role,strlen(role) + 1);
+			if ( !e->members[e->memberCount].role )
+				return O5MREADER_ITERATE_RET_ERR;
+			e->memberCount++;
+		} while ( ret == O5MREADER_ITERATE_RET_NEXT );
+		if ( ret == O5MREADER_ITERATE_RET_ERR )
+			return O5MREADER_ITERATE_RET_ERR;
+	}
+	
+	while ( (ret = o5mreader_iterateTags(pReader,&key,&val)) == O5MREADER_ITERATE_RET_NEXT ) {
+		if ( e->tagCount == pReader->tagCap &&
+			!o5mreader_grow(pReader,(void**)&e->tags,&pReader->tagCap,e->tagCount + 1,sizeof(O5mreaderTag)) )
+			return O5MREADER_ITERATE_RET_ERR;
+		e->tags[e->tagCount].key = key;
+		e->tags[e->tagCount].val = val;
+		e->tags[e->tagCount].pair = pReader->lastPairIndex ?
+			pReader->pairBase + pReader->lastPairIndex - STR_PAIR_TABLE_SIZE + 1 : 0;
+		if ( copyTags || !pReader->lastPairIndex ) {
+			if ( !o5mreader_arenaTag(pReader,&e->tags[e->tagCount]) )
+				return O5MREADER_ITERATE_RET_ERR;
+		}
+		else if ( pReader->lastPairIndex < oldest ) {
+			oldest = pReader->lastPairIndex;
+		}
+		e->tagCount++;
+		/* the next new pair would overwrite the oldest slot we point to */
+		if ( !copyTags && oldest != (uint64_t)-1 && pReader->strPairPointer >= oldest ) {
+			for ( i = 0; i < e->tagCount; i++ ) {
+				if ( e->tags[i].key >= pReader->strPairTable &&
+					e->tags[i].key < pReader->strPairTable + STR_PAIR_TABLE_SIZE * STR_PAIR_STRING_SIZE &&
+					!o5mreader_arenaTag(pReader,&e->tags[i]) )
+					return O5MREADER_ITERATE_RET_ERR;
+			}
+			copyTags = 1;
+		}
+	}
+	if ( ret == O5MREADER_ITERATE_RET_ERR )
+		return O5MREADER_ITERATE_RET_ERR;
+	if ( pReader->filter && !e->ds.isEmpty && !pReader->filter(e,1,pReader->filterData) )
+		goto next;
+	
+	return O5MREADER_ITERATE_RET_NEXT;
+}
+
+/*
+** Install a filter for o5mreader_readEntity, NULL removes it. Entities the
+** filter rejects on their header are not decoded into the entity at all:
+** their node refs, members and tags are only read as far as the delta
+** coding and the string table of the following datasets need it.
+*/
+void o5mreader_setFilter(O5mreader *pReader, O5mreaderFilter filter, void *userData) {
+	pReader->filter = filter;
+	pReader->filterData = userData;
+}
+
+/*
+** Decode all remaining entities and pass each to visitor. Stops early with
+** NEXT when the visitor returns non-zero, otherwise returns DONE or ERR.
+*/
+O5mreaderIterateRet o5mreader_visitEntities(O5mreader *pReader, O5mreaderVisitor visitor, void *userData) {
+	O5mreaderEntity *e;
+	O5mreaderIterateRet ret;
+	
+	while ( (ret = o5mreader_readEntity(pReader,&e)) == O5MREADER_ITERATE_RET_NEXT ) {
+		if ( visitor(e,userData) )
+			return O5MREADER_ITERATE_RET_NEXT;
+	}
+	return ret;
+}
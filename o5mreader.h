@@ -35,10 +35,64 @@
 typedef int O5mreaderRet;
 typedef int O5mreaderIterateRet;
 
+typedef struct {	
+	uint8_t type;	
+	uint64_t id;
+	uint32_t version;
+	uint8_t isEmpty;
+	int32_t lon;
+	int32_t lat;	
+} O5mreaderDataset;
+
+typedef struct {
+	char *key;
+	char *val;
+	uint64_t pair;	/* identity of the string pair within the reader, equal for repeats; 0 = not in the string table */
+} O5mreaderTag;
+
+typedef struct {
+	uint64_t id;
+	uint8_t type;
+	char *role;
+} O5mreaderMember;
+
+/*
+** A completely decoded node, way or relation. All arrays and strings live
+** in the reader's entity arena and are valid until the next entity is read.
+*/
+typedef struct {
+	O5mreaderDataset ds;
+	O5mreaderTag *tags;
+	size_t tagCount;
+	uint64_t *nds;
+	size_t ndCount;
+	O5mreaderMember *members;
+	size_t memberCount;
+} O5mreaderEntity;
+
+/*
+** Entity filter, see o5mreader_setFilter. Called with complete==0 after the
+** dataset header (type, id and the location of a node) and with complete==1
+** after the whole entity is decoded; returning 0 skips the entity.
+*/
+typedef int (*O5mreaderFilter)(const O5mreaderEntity *entity, int complete, void *userData);
+
+#ifndef O5MREADER_BUFFER_SIZE
+#define O5MREADER_BUFFER_SIZE (4*1024*1024)
+#endif
+#define O5MREADER_STR_BUFFER_SIZE 1024
+
 typedef struct {
 	int errCode;
 	char* errMsg;
 	FILE *f;
+	uint8_t *buf;		/* input window: whole mmap'd file or owned read buffer */
+	uint8_t *pos;		/* current decode position inside buf */
+	uint8_t *end;		/* end of valid bytes inside buf */
+	uint64_t bufBase;	/* file offset of buf[0] */
+	size_t bufSize;
+	uint8_t isMapped;
+	uint64_t limit;		/* end offset of the decoded range, 0 = whole input */
 	uint64_t offset;
 	uint64_t offsetNd;
 	uint64_t offsetRf;
@@ -56,36 +110,64 @@ typedef struct {
 	uint8_t canIterateTags;
 	uint8_t canIterateNds;
 	uint8_t canIterateRefs;
-	char** strPairTable;
+	char* strPairTable;	/* STR_PAIR_TABLE_SIZE slots, allocated with the reader */
+	uint64_t strPairPointer;	/* ring position of the next new string pair */
+	char strBuffer[O5MREADER_STR_BUFFER_SIZE];
+	uint64_t lastPairIndex;	/* ring position (+STR_PAIR_TABLE_SIZE) of the last pair read, 0 = not in the table */
+	uint64_t pairBase;	/* pairs numbered before the last reset, see O5mreaderTag.pair */
+	O5mreaderEntity entity;	/* entity arena, see o5mreader_readEntity */
+	size_t tagCap, ndCap, memberCap;
+	struct O5mreaderArenaBlock *arenaFirst, *arenaCur;
+	size_t arenaUsed;
+	O5mreaderFilter filter;	/* see o5mreader_setFilter */
+	void *filterData;
 } O5mreader;
 
-typedef struct {	
-	uint8_t type;	
-	uint64_t id;
-	uint32_t version;
-	uint8_t isEmpty;
-	int32_t lon;
-	int32_t lat;	
-} O5mreaderDataset;
-
 #if defined (__cplusplus)
 extern "C" {
 #endif
 
 O5mreaderRet o5mreader_open(O5mreader **ppReader,FILE* f);
 
+O5mreaderRet o5mreader_openRange(O5mreader **ppReader,FILE* f,uint64_t start,uint64_t end);
+
+O5mreaderRet o5mreader_scanResets(FILE* f,uint64_t minChunk,uint64_t **pOffsets,size_t *pCount);
+
+uint64_t o5mreader_tell(O5mreader *pReader);
+
+size_t o5mreader_stateSize(O5mreader *pReader);
+
+uint64_t o5mreader_saveState(O5mreader *pReader, void *state);
+
+O5mreaderRet o5mreader_openState(O5mreader **ppReader,FILE* f,uint64_t start,const void *state,size_t size);
+
 void o5mreader_close(O5mreader *pReader);
 
+/* read buffer size of the readers opened after the call, for unmapped input */
+void o5mreader_setBufferSize(size_t size);
+
 const char* o5mreader_strerror(int errCode);
 
 O5mreaderIterateRet o5mreader_iterateDataSet(O5mreader *pReader, O5mreaderDataset* ds);
 
+O5mreaderIterateRet o5mreader_readEntity(O5mreader *pReader, O5mreaderEntity **ppEntity);
+
+void o5mreader_setFilter(O5mreader *pReader, O5mreaderFilter filter, void *userData);
+
+typedef int (*O5mreaderVisitor)(const O5mreaderEntity *entity, void *userData);
+
+O5mreaderIterateRet o5mreader_visitEntities(O5mreader *pReader, O5mreaderVisitor visitor, void *userData);
+
 O5mreaderIterateRet o5mreader_iterateTags(O5mreader *pReader, char** pKey, char** pVal);
 
 O5mreaderIterateRet o5mreader_iterateNds(O5mreader *pReader, uint64_t *nodeId);
 
+O5mreaderIterateRet o5mreader_readNds(O5mreader *pReader, uint64_t *nodeIds, size_t maxCount, size_t *pCount);
+
 O5mreaderIterateRet o5mreader_iterateRefs(O5mreader *pReader, uint64_t *refId, uint8_t *type, char** pRole);
 
+O5mreaderIterateRet o5mreader_readRefs(O5mreader *pReader, uint64_t *refIds, uint8_t *types, char** roles, size_t maxCount, size_t *pCount);
+
 O5mreaderIterateRet o5mreader_readRel(O5mreader *pReader, O5mreaderDataset* ds);
 
 O5mreaderIterateRet o5mreader_skipTags(O5mreader *pReader);
@@ -0,0 +1,241 @@
+/*
+** waynodes
+**
+** Packed way node lists for o5m2sqlite --ways=packed: the node ids of a way
+** as one BLOB of varints, each the zigzag encoded difference to the
+** previous id (the first to 0), the encoding o5m uses for node references.
+**
+** Provides the table-valued function way_nodes_unpack(blob) with the
+** columns local_order and node_id, and the scalar way_nodes_count(blob).
+** o5m2sqlite includes this file; to use the functions in other programs
+** build it as loadable extension:
+**
+**   gcc -O2 -fPIC -shared waynodes.c -o waynodes.so
+**
+**   sqlite> .load ./waynodes
+**   sqlite> SELECT local_order,node_id FROM ways,way_nodes_unpack(ways.nodes) WHERE way_id=4;
+*/
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sqlite3ext.h"
+SQLITE_EXTENSION_INIT1
+
+#ifdef SQLITE_CORE
+/* the packing side is only needed when the file is compiled into o5m2sqlite */
+
+/* upper bound of the packed size of n node ids */
+#define WAYNODES_MAX_SIZE(n) ((n)*10)
+
+/* pack n node ids into out, returns the number of bytes written */
+static size_t waynodes_pack( const uint64_t *ids, size_t n, uint8_t *out ) {
+    uint8_t *p = out;
+    int64_t prev = 0, d;
+    uint64_t z;
+    size_t i;
+
+    for( i=0; i<n; i++ ) {
+        d = (int64_t)ids[i] - prev;
+        prev = (int64_t)ids[i];
+        z = ((uint64_t)d << 1) ^ (uint64_t)(d >> 63);
+        while( z>=0x80 ) {
+            *p++ = (uint8_t)z | 0x80;
+            z >>= 7;
+        }
+        *p++ = (uint8_t)z;
+    }
+    return p - out;
+}
+#endif
+
+/* add the next delta to *id, returns NULL at the end or on a truncated varint */
+static const uint8_t *waynodes_next( const uint8_t *p, const uint8_t *end, int64_t *id ) {
+    uint64_t z = 0;
+    int shift = 0;
+
+    while( p<end && shift<64 ) {
+        z |= (uint64_t)(*p & 0x7f) << shift;
+        if( !(*p++ & 0x80) ) {
+            *id += (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+            return p;
+        }
+        shift += 7;
+    }
+    return NULL;
+}
+
+/*
+** way_nodes_unpack: eponymous virtual table, the blob is the hidden
+** column 'nodes' and has to be given as argument.
+*/
+typedef struct {
+    sqlite3_vtab_cursor base;
+    uint8_t *blob;
+    const uint8_t *pos, *end;
+    int64_t node_id;
+    sqlite3_int64 local_order;  /* 0 = at the end */
+} WaynodesCursor;
+
+#define WAYNODES_COL_LOCAL_ORDER 0
+#define WAYNODES_COL_NODE_ID 1
+#define WAYNODES_COL_NODES 2
+
+static int waynodesConnect( sqlite3 *db, void *aux, int argc, const char *const *argv, sqlite3_vtab **ppVtab, char **pzErr ) {
+    int rc = sqlite3_declare_vtab(db, "CREATE TABLE x(local_order INTEGER,node_id INTEGER,nodes HIDDEN)");
+    (void)aux; (void)argc; (void)argv; (void)pzErr;
+    if( rc!=SQLITE_OK ) return rc;
+    *ppVtab = sqlite3_malloc(sizeof(sqlite3_vtab));
+    if( *ppVtab==NULL ) return SQLITE_NOMEM;
+    memset(*ppVtab, 0, sizeof(sqlite3_vtab));
+    sqlite3_vtab_config(db, SQLITE_VTAB_INNOCUOUS);
+    return SQLITE_OK;
+}
+
+static int waynodesDisconnect( sqlite3_vtab *pVtab ) {
+    sqlite3_free(pVtab);
+    return SQLITE_OK;
+}
+
+static int waynodesOpen( sqlite3_vtab *pVtab, sqlite3_vtab_cursor **ppCursor ) {
+    WaynodesCursor *c = sqlite3_malloc(sizeof(WaynodesCursor));
+    (void)pVtab;
+    if( c==NULL ) return SQLITE_NOMEM;
+    memset(c, 0, sizeof(WaynodesCursor));
+    *ppCursor = &c->base;
+    return SQLITE_OK;
+}
+
+static int waynodesClose( sqlite3_vtab_cursor *cur ) {
+    WaynodesCursor *c = (WaynodesCursor *)cur;
+    sqlite3_free(c->blob);
+    sqlite3_free(c);
+    return SQLITE_OK;
+}
+
+static int waynodesNext( sqlite3_vtab_cursor *cur ) {
+    WaynodesCursor *c = (WaynodesCursor *)cur;
+    c->pos = c->pos ? waynodes_next(c->pos, c->end, &c->node_id) : NULL;
+    c->local_order = c->pos ? c->local_order+1 : 0;
+    return SQLITE_OK;
+}
+
+static int waynodesFilter( sqlite3_vtab_cursor *cur, int idxNum, const char *idxStr, int argc, sqlite3_value **argv ) {
+    WaynodesCursor *c = (WaynodesCursor *)cur;
+    int len = argc>0 ? sqlite3_value_bytes(argv[0]) : 0;
+
+    (void)idxNum; (void)idxStr;
+    sqlite3_free(c->blob);
+    c->blob = NULL;
+    c->pos = c->end = NULL;
+    c->node_id = c->local_order = 0;
+    if( len>0 ) {
+        c->blob = sqlite3_malloc(len);
+        if( c->blob==NULL ) return SQLITE_NOMEM;
+        memcpy(c->blob, sqlite3_value_blob(argv[0]), len);
+        c->pos = c->blob;
+        c->end = c->blob + len;
+    }
+    return waynodesNext(cur);
+}
+
+static int waynodesEof( sqlite3_vtab_cursor *cur ) {
+    return ((WaynodesCursor *)cur)->local_order==0;
+}
+
+static int waynodesColumn( sqlite3_vtab_cursor *cur, sqlite3_context *ctx, int i ) {
+    WaynodesCursor *c = (WaynodesCursor *)cur;
+    switch( i ) {
+        case WAYNODES_COL_LOCAL_ORDER: sqlite3_result_int64(ctx, c->local_order); break;
+        case WAYNODES_COL_NODE_ID:     sqlite3_result_int64(ctx, c->node_id); break;
+        default:                       sqlite3_result_blob(ctx, c->blob, c->end - (const uint8_t *)c->blob, SQLITE_TRANSIENT); break;
+    }
+    return SQLITE_OK;
+}
+
+static int waynodesRowid( sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid ) {
+    *pRowid = ((WaynodesCursor *)cur)->local_order;
+    return SQLITE_OK;
+}
+
+/* the nodes argument is required */
+static int waynodesBestIndex( sqlite3_vtab *tab, sqlite3_index_info *info ) {
+    int i;
+    (void)tab;
+    for( i=0; i<info->nConstraint; i++ ) {
+        if( info->aConstraint[i].iColumn!=WAYNODES_COL_NODES ) continue;
+        if( info->aConstraint[i].op!=SQLITE_INDEX_CONSTRAINT_EQ ) continue;
+        if( !info->aConstraint[i].usable ) return SQLITE_CONSTRAINT;
+        info->aConstraintUsage[i].argvIndex = 1;
+        info->aConstraintUsage[i].omit = 1;
+        info->estimatedCost = 10;
+        info->estimatedRows = 10;
+        info->orderByConsumed = info->nOrderBy==1 && info->aOrderBy[0].iColumn==WAYNODES_COL_LOCAL_ORDER &&
+            !info->aOrderBy[0].desc;
+        return SQLITE_OK;
+    }
+    return SQLITE_CONSTRAINT;
+}
+
+static sqlite3_module waynodesModule = {
+    0,                      /* iVersion */
+    0,                      /* xCreate, eponymous only */
+    waynodesConnect,
+    waynodesBestIndex,
+    waynodesDisconnect,
+    0,                      /* xDestroy */
+    waynodesOpen,
+    waynodesClose,
+    waynodesFilter,
+    waynodesNext,
+    waynodesEof,
+    waynodesColumn,
+    waynodesRowid,
+    0,                      /* xUpdate */
+    0,                      /* xBegin */
+    0,                      /* xSync */
+    0,                      /* xCommit */
+    0,                      /* xRollback */
+    0,                      /* xFindFunction */
+    0,                      /* xRename */
+    0,                      /* xSavepoint */
+    0,                      /* xRelease */
+    0,                      /* xRollbackTo */
+    0,                      /* xShadowName */
+#if SQLITE_VERSION_NUMBER>=3044000
+    0,                      /* xIntegrity */
+#endif
+};
+
+/* way_nodes_count(blob): number of node ids, NULL for a malformed blob */
+static void waynodesCount( sqlite3_context *ctx, int argc, sqlite3_value **argv ) {
+    const uint8_t *p = sqlite3_value_blob(argv[0]);
+    const uint8_t *end = p + sqlite3_value_bytes(argv[0]);
+    sqlite3_int64 n = 0;
+
+    (void)argc;
+    if( p==NULL ) {
+        sqlite3_result_int(ctx, 0);
+        return;
+    }
+    for( ; p<end; p++ ) if( !(*p & 0x80) ) n++;
+    if( end>(const uint8_t *)sqlite3_value_blob(argv[0]) && (end[-1] & 0x80) ) sqlite3_result_null(ctx);
+    else sqlite3_result_int64(ctx, n);
+}
+
+static int waynodes_register( sqlite3 *db ) {
+    int rc = sqlite3_create_module(db, "way_nodes_unpack", &waynodesModule, NULL);
+    if( rc==SQLITE_OK )
+        rc = sqlite3_create_function(db, "way_nodes_count", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS,
+            NULL, waynodesCount, NULL, NULL);
+    return rc;
+}
+
+#ifdef _WIN32
+__declspec(dllexport)
+#endif
+int sqlite3_waynodes_init( sqlite3 *db, char **pzErrMsg, const sqlite3_api_routines *pApi ) {
+    SQLITE_EXTENSION_INIT2(pApi);
+    (void)pzErrMsg;
+    return waynodes_register(db);
+}